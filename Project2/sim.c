@@ -8,656 +8,5509 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined( __SSE2__ ) || defined( __AVX2__ )
+#include <immintrin.h>
+#endif
+
+#define MEM_SIZE_IN_WORDS ( 1u << 30 )  /* the full 32-bit byte address space */
+#define PAGE_SHIFT 12
+#define PAGE_WORDS ( 1 << ( PAGE_SHIFT - 2 ) )
+#define DIR_SHIFT 10         /* page number bits resolved by each directory level */
+#define TLB_SIZE 64
+#define CACHE_SETS 8         /* default geometry: 512 bytes, 4-way, 16-byte lines */
+#define CACHE_WAYS 4
+#define CACHE_LINE 16
+#define MAX_WAYS   64        /* tree bits of a set fit in 64 */
+#define RRPV_MAX    3        /* re-reference predictions are 0 to 3 */
+#define PSEL_MAX    1023
+#define BRRIP_LONG  32       /* one BRRIP fill in this many is not distant */
+#define DUEL_PERIOD 32       /* the first and last sets of each are DRRIP's leaders */
+
+/* a set-associative write-back data cache.  Everything about a set is
+   one block of set_words 64-bit words: its tree bits, the dirty bits of
+   its ways, then one 32-bit entry per way holding ( tag << 1 ) | 1 for a
+   valid line and 0 for an empty one, so that a lookup reads one stretch
+   of host memory and finds a hit, or an empty way, by comparing all the
+   entries with one value.  Line (set, way) is number set * ways + way.
+   Replacement is tree pseudo-LRU unless another policy is chosen: a
+   set's ways are the leaves of a binary tree whose ways - 1 inner
+   nodes, numbered 1 to ways - 1 from the root as in a heap, are the
+   tree bits.  Each bit points to the half of its subtree to replace
+   next, and an access points the bits on its way's path away from it.
+   The other policies keep a byte per line in rank, outside the blocks */
+
+#define SET_PLRU  0          /* words of a set's block */
+#define SET_DIRTY 1
+#define SET_TAGS  2
+
+#define NUM_POLICIES  8     /* replacement policies, see policy_victim() */
+#define POLICY_PLRU   0
+#define POLICY_LRU    1
+#define POLICY_FIFO   2
+#define POLICY_RANDOM 3
+#define POLICY_NRU    4
+#define POLICY_SRRIP  5
+#define POLICY_BRRIP  6
+#define POLICY_DRRIP  7
+
+struct cache {
+  unsigned int
+    sets,         /* each a power of two */
+    ways,
+    line_size,    /* bytes               */
+    offset_bits,  /* log2 of line_size   */
+    tag_shift,    /* offset and index bits */
+    set_words,    /* 64-bit words of each set's block */
+    policy,       /* index into policy_names[] */
+    psel,         /* DRRIP's choice between its policies */
+    seed;         /* of the random choices */
+  uint64_t *data, /* the blocks of the sets */
+           *touch; /* for each way, the bits an access clears and sets */
+  unsigned char *rank; /* replacement state of each line, for policies but PLRU */
 
-void cache_stats( void );
-void cache_init( void );
-void cache_access( unsigned int address, unsigned int type );
+  unsigned int
+    cache_reads,  /* counter */
+    cache_writes, /* counter */
+    hits,         /* counter */
+    misses,       /* counter */
+    write_backs,  /* counter */
+
+    off;          /* accesses are not modelled while set */
+  struct hierarchy *hier; /* the levels below an L1 of -H, or NULL */
+};
+
+struct machine;
+
+/* a loaded program: words to place in memory and where to start */
+
+struct segment {
+  int addr,                /* byte address of the first word          */
+      words,               /* words of data                           */
+      fill,                /* zero words following the data           */
+      *data;
+};
+
+struct image {
+  int entry,               /* address of the first instruction        */
+      num_segments,
+      from_hex;            /* read as hex words, for the load listing */
+  struct segment *segments;
+};
+
+/* pre-decoded instruction store: each memory word is decoded once, on
+   its first fetch, into a record holding the handler and the fields it
+   uses; a store into the word clears the record so it is decoded again */
+
+struct decoded {
+  void (*handler)( struct machine *m ); /* semantic routine selected by op1 */
+  int ir,                  /* raw instruction word                     */
+      op1, d, s1, s2,      /* register and opcode fields               */
+      genset,              /* low 16 bits of the instruction           */
+      imm,                 /* sign-extended immediate or displacement  */
+      valid;               /* record matches the word in memory        */
+  void *target;            /* handler label in the threaded engine     */
+};
+
+/* a 4 KB page of guest memory, with the pre-decode records and the JIT
+   state for its words allocated separately once they are needed */
+
+struct page {
+  int word[PAGE_WORDS];
+  struct decoded *decoded;
+  struct jit_page *jit;
+  struct frame *saved;     /* copy in the last snapshot, if any        */
+  struct profile_page *prof; /* -P counts for the page's words         */
+  unsigned int vpn,        /* page number                              */
+               dirty;      /* stored to since saved was taken          */
+  struct page *next;       /* all pages of the machine, for freeing    */
+};
+
+/* saved contents of a page, shared by every snapshot in which the page
+   had not changed */
+
+struct frame {
+  int refs;
+  int word[PAGE_WORDS];
+};
+
+struct tlb_entry {
+  unsigned int vpn;        /* page number, ~0 when empty               */
+  struct page *page;
+};
+
+/* one simulated i860: every piece of state a simulation touches lives
+   here, so any number of machines can run at once in one process */
+
+struct machine {
+
+  /* processor state, simulation state, and instruction fields    */
+
+  int reg[32],       /* general register set, r0 is always 0    */
+      xip,           /* execute instruction pointer             */
+      fip,           /* fetch instruction pointer               */
+      halt_flag,     /* set by halt instruction                 */
+      verbose,       /* governs amount of detail in output      */
+      ir,            /* 32-bit instruction register             */
+      op1,           /* 6-bit primary opcode in bits 31 to 27   */
+      d,             /* 5-bit destination register identifier   */
+      s1,            /* 5-bit source 1 register identifier      */
+      s2,            /* 5-bit source 2 register identifier      */
+      eff_addr,      /* 32-bit effective address                */
+      cc_bit,        /* condition code set                      */
+      genset;        /* general offset                          */
+
+  /* dynamic execution statistics */
+
+  int inst_fetches,
+      memory_reads,
+      memory_writes,
+      branches,
+      taken;
+
+  struct page **dir[1 << DIR_SHIFT];  /* page directory, by top page bits */
+  struct tlb_entry tlb[TLB_SIZE];
+  struct page *pages;      /* every allocated page                        */
+  int num_pages;
+  struct image image;      /* loaded program, kept for reset_machine()     */
+  struct cache cache;
+  struct jit *jit;         /* translation state, if the JIT engine ran    */
+  struct profile *prof;    /* loop table, for -P                          */
+  struct predictors *bp;   /* branch predictor models, for -B             */
+  struct timing *timing;   /* pipeline timing model, for -C               */
+  struct ilp *ilp;         /* dependency graph schedules, for -I          */
+  struct hierarchy *hier;  /* L1I, L2 and L3 around the cache, for -H     */
+  struct mrc *mrc;         /* LRU stack distances, for -M                 */
+  struct policies *policies; /* a cache under each replacement policy, for -R */
+  struct multicore *mc;    /* the system this core belongs to, for -N     */
+  int core;                /* this core's number in mc                    */
+  int job;                 /* runs a job of -j: program errors end the job */
+  FILE *out;               /* trace and statistics output                 */
+};
+
+/* MESI state of one core's cache that the cache itself does not keep,
+   and the bus traffic the core caused or answered */
+
+struct coherence {
+  unsigned char *shared;  /* clean line may be in another cache, by line */
+  unsigned int
+    bus_reads,            /* read misses                               */
+    bus_read_exclusives,  /* write misses                              */
+    upgrades,             /* writes to a shared line                   */
+    invalidations,        /* lines taken away by another core's write  */
+    interventions;        /* modified lines supplied to another core   */
+};
+
+/* cores sharing one memory, for -N */
+
+struct multicore {
+  int num_cores,
+      quantum;                 /* instructions between barriers         */
+  struct machine *memory,      /* loaded the program; owns the pages    */
+                 **cores;
+  struct coherence *coh;       /* one per core                          */
+  pthread_mutex_t bus,         /* held for every data access and decode */
+                  pages;       /* held while the page directory changes */
+  pthread_barrier_t barrier;
+  int failed;                  /* a core ran out of memory              */
+};
+
+void cache_stats( struct cache *c, FILE *out );
+void cache_init( struct cache *c );
+void cache_configure( struct cache *c, unsigned int sets, unsigned int ways, unsigned int line_size );
+void cache_free( struct cache *c );
+void cache_access( struct cache *c, unsigned int address, unsigned int type );
+__attribute__(( cold )) int hierarchy_fill( struct cache *c, unsigned int line, unsigned int address );
+void jit_note_store( struct machine *m, unsigned int addr );
+void coherent_access( struct machine *m, unsigned int address, unsigned int type );
+struct page *shared_page_fill( struct machine *m, unsigned int addr );
+
+/* errors the simulator cannot run past end it, except on a thread that
+   set an escape: run_job() sets one so that the error ends only its job
+   of -j, and core_main() so that a core of -N stops the others first */
+
+__thread jmp_buf *fail_escape;
+__thread FILE *fail_out;
+
+__attribute__(( noreturn, cold )) void fail( void ){
+  if( fail_escape ) longjmp( *fail_escape, 1 );
+  exit( -1 );
+}
 
-#define MEM_SIZE_IN_WORDS 256*1024
-#define LINES_PER_BANK 8
-#define NUM_BANKS 8
+__attribute__(( noreturn, cold )) void out_of_memory( void ){
+  fprintf( fail_escape ? fail_out : stdout, "out of memory\n" );
+  fail();
+}
 
+/* guest memory covers the full 32-bit address space in 4 KB pages that
+   are allocated, zero filled, on first touch.  A two-level directory
+   maps a page number to its page, and a small direct-mapped TLB in
+   front of it catches nearly every access */
 
-int mem[MEM_SIZE_IN_WORDS];
-unsigned int
-  plru_state[NUM_BANKS],               /* current state for each set */
-  valid[NUM_BANKS][LINES_PER_BANK],    /* valid bit for each line    */
-  dirty[NUM_BANKS][LINES_PER_BANK],    /* dirty bit for each line    */
-  tag[NUM_BANKS][LINES_PER_BANK],      /* tag bits for each line     */
+/* the directory's page for vpn, allocated if need be; NULL when there
+   is no memory for it */
+struct page *page_find( struct machine *m, unsigned int vpn ){
+  struct page ***dir = &m->dir[ vpn >> DIR_SHIFT ];
+  struct page **slot;
 
-  plru_bank[8] /* table for bank replacement choice based on state */
+  if( !*dir ){
+    *dir = calloc( 1 << DIR_SHIFT, sizeof( struct page * ) );
+    if( !*dir ) return NULL;
+  }
+  slot = &( *dir )[ vpn & ( ( 1 << DIR_SHIFT ) - 1 ) ];
+  if( !*slot ){
+    *slot = calloc( 1, sizeof( struct page ) );
+    if( !*slot ) return NULL;
+    ( *slot )->vpn = vpn;
+    ( *slot )->next = m->pages;
+    m->pages = *slot;
+    m->num_pages++;
+  }
+  return *slot;
+}
 
-                 = { 0, 0, 1, 1, 2, 3, 2, 3 },
+struct page *page_fill( struct machine *m, unsigned int addr ){
+  unsigned int vpn = addr >> PAGE_SHIFT;
 
-  next_state[32] /* table for next state based on state and bank ref */
-                 /* index by 5-bit (4*state)+bank [=(state<<2)|bank] */
+  if( m->mc ) return shared_page_fill( m, addr );
+  struct page *p = page_find( m, vpn );
+  if( !p ) out_of_memory();
 
-                                    /*  bank ref  */
-                                    /* 0  1  2  3 */
+  struct tlb_entry *e = &m->tlb[ vpn & ( TLB_SIZE - 1 ) ];
+  e->vpn  = vpn;
+  e->page = p;
+  return p;
+}
 
-                 /*         0 */  = {  6, 4, 1, 0,
-                 /*         1 */       7, 5, 1, 0,
-                 /*         2 */       6, 4, 3, 2,
-                 /* current 3 */       7, 5, 3, 2,
-                 /*  state  4 */       6, 4, 1, 0,
-                 /*         5 */       7, 5, 1, 0,
-                 /*         6 */       6, 4, 3, 2,
-                 /*         7 */       7, 5, 3, 2  };
+static inline struct page *mem_page( struct machine *m, unsigned int addr ){
+  struct tlb_entry *e = &m->tlb[ ( addr >> PAGE_SHIFT ) & ( TLB_SIZE - 1 ) ];
+  if( e->vpn == ( addr >> PAGE_SHIFT ) ) return e->page;
+  return page_fill( m, addr );
+}
 
-unsigned int
-    cache_reads,  /* counter */
-    cache_writes, /* counter */
-    hits,         /* counter */
-    misses,       /* counter */
-    write_backs;  /* counter */
+/* the memory word holding byte address addr */
+static inline int *mem_word( struct machine *m, unsigned int addr ){
+  return &mem_page( m, addr )->word[ ( addr >> 2 ) & ( PAGE_WORDS - 1 ) ];
+}
+
+/* the pre-decode record for the word at addr; the records for a page
+   are only allocated once code is fetched from it.  A shared page of -N
+   has a page of records for each core, and core k's are k * PAGE_WORDS
+   on from these */
+static inline struct decoded *decoded_at( struct machine *m, unsigned int addr ){
+  struct page *p = mem_page( m, addr );
+  if( !p->decoded ){
+    p->decoded = calloc( PAGE_WORDS, sizeof( struct decoded ) );
+    if( !p->decoded ) out_of_memory();
+  }
+  return &p->decoded[ ( addr >> 2 ) & ( PAGE_WORDS - 1 ) ];
+}
+
+void frame_release( struct frame *f ){
+  if( f && ( --f->refs == 0 ) ) free( f );
+}
+
+/* drop every page, leaving all of memory zero */
+void mem_free( struct machine *m ){
+  while( m->pages ){
+    struct page *p = m->pages;
+    m->pages = p->next;
+    free( p->decoded );
+    free( p->jit );
+    frame_release( p->saved );
+    free( p->prof );
+    free( p );
+  }
+  for( int i = 0; i < ( 1 << DIR_SHIFT ); i++ ){
+    free( m->dir[ i ] );
+    m->dir[ i ] = NULL;
+  }
+  for( int i = 0; i < TLB_SIZE; i++ ) m->tlb[ i ].vpn = ~0u;
+  m->num_pages = 0;
+}
+
+struct machine *machine_create( FILE *out ){
+  struct machine *m = calloc( 1, sizeof( *m ) );
+  if( !m ) out_of_memory();
+  mem_free( m );
+  m->out = out;
+  cache_configure( &m->cache, CACHE_SETS, CACHE_WAYS, CACHE_LINE );
+  return m;
+}
+
+/* program loading.  Input is either the hex word format, placed at
+   address 0, or a binary image:
 
-/* processor state, simulation state, and instruction fields    */
+     header    "i860", version (1), entry address, number of segments
+     segments  address, words in the file, words in memory, file offset
+     data      the segments' words
 
-int reg[32]   = {0}, /* general register set, r0 is always 0    */
-    xip       = 0,   /* execute instruction pointer             */
-    fip       = 0,   /* fetch instruction pointer               */
-    halt_flag = 0,   /* set by halt instruction                 */
-    verbose   = 0,   /* governs amount of detail in output      */
-    ir,              /* 32-bit instruction register             */
-    op1,             /* 6-bit primary opcode in bits 31 to 27   */
-    d,               /* 5-bit destination register identifier   */
-    s1,              /* 5-bit source 1 register identifier      */
-    s2,              /* 5-bit source 2 register identifier      */
-    imm16,           /* 16-bit immediate field                  */
-    scaled,          /* scaled addressing mode bit 9            */
-    eff_addr,        /* 32-bit effective address                */
-    cc_bit = 0,      /* condition code set                      */
-    genset;          /* general offset                          */     
+   all as 32-bit little-endian values.  Memory words past a segment's
+   file words are zero filled.  Regular files are read through mmap; a
+   pipe is read into a buffer first */
 
-/* dynamic execution statistics */
+#define IMAGE_MAGIC   0x30363869  /* "i860" */
+#define IMAGE_VERSION 1
 
-int inst_fetches = 0,
-    memory_reads = 0,
-    memory_writes = 0,
-    branches = 0,
-    taken = 0;
+struct image_header {
+  uint32_t magic, version, entry, num_segments;
+};
 
+struct image_segment {
+  uint32_t addr, file_words, mem_words, offset;
+};
 
-/* load memory from stdin */
+void add_segment( struct image *img, int addr, int words, int fill, int *data ){
+  img->segments = realloc( img->segments, ( img->num_segments + 1 ) * sizeof( struct segment ) );
+  struct segment *s = &img->segments[ img->num_segments++ ];
+  s->addr  = addr;
+  s->words = words;
+  s->fill  = fill;
+  s->data  = data;
+}
+
+/* the whole input, mapped when it is a regular file */
+char *read_input( FILE *in, size_t *size, int *mapped ){
+  struct stat st;
+  char *buf;
+
+  if( ( fstat( fileno( in ), &st ) == 0 ) && S_ISREG( st.st_mode ) && ( st.st_size > 0 ) ){
+    buf = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno( in ), 0 );
+    if( buf != MAP_FAILED ){
+      *size = st.st_size;
+      *mapped = 1;
+      return buf;
+    }
+  }
+
+  size_t cap = 1 << 16, n;
+  *size = 0;
+  *mapped = 0;
+  buf = malloc( cap );
+  while( ( n = fread( buf + *size, 1, cap - *size, in ) ) > 0 ){
+    *size += n;
+    if( *size == cap ) buf = realloc( buf, cap *= 2 );
+  }
+  return buf;
+}
+
+/* same words scanf( "%x" ) would read, stopping at the first token that
+   is not hex.  Returns 0, or -1 when the words do not fit in memory */
+int parse_hex( struct machine *m, const char *p, const char *end ){
+  static signed char digit[256];
+  int count = 0, cap = 1024;
+  int *words = malloc( cap * sizeof( int ) );
+
+  if( !digit[ 'f' ] ){
+    memset( digit, -1, sizeof( digit ) );
+    for( int i = 0; i < 10; i++ ) digit[ '0' + i ] = i;
+    for( int i = 0; i < 6; i++ ) digit[ 'a' + i ] = digit[ 'A' + i ] = 10 + i;
+  }
+
+  for( ;; ){
+    while( ( p < end ) && ( ( *p == ' ' ) || ( ( *p >= '\t' ) && ( *p <= '\r' ) ) ) ) p++;
+    if( p == end ) break;
+    if( ( end - p > 2 ) && ( p[0] == '0' ) && ( ( p[1] | 0x20 ) == 'x' ) && ( digit[ (unsigned char)p[2] ] >= 0 ) ) p += 2;
+    if( digit[ (unsigned char)*p ] < 0 ) break;
+
+    unsigned int w = 0;
+    while( ( p < end ) && ( digit[ (unsigned char)*p ] >= 0 ) ) w = ( w << 4 ) | digit[ (unsigned char)*p++ ];
+
+    if( count == MEM_SIZE_IN_WORDS ){
+      fprintf( m->out, "too many words loaded\n" );
+      free( words );
+      return -1;
+    }
+    if( count == cap ) words = realloc( words, ( cap *= 2 ) * sizeof( int ) );
+    words[ count++ ] = w;
+  }
+
+  m->image.entry = 0;
+  m->image.from_hex = 1;
+  add_segment( &m->image, 0, count, 0, words );
+  return 0;
+}
+
+/* returns 0, or -1 for a bad image, with the segments before the bad
+   one added */
+int parse_binary( struct machine *m, const char *buf, size_t size ){
+  struct image_header h;
+  memcpy( &h, buf, sizeof( h ) );
+  if( ( h.version != IMAGE_VERSION ) ||
+      ( sizeof( h ) + (size_t)h.num_segments * sizeof( struct image_segment ) > size ) ){
+    fprintf( m->out, "bad image header\n" );
+    return -1;
+  }
 
-#define INPUT_WORD_LIMIT 255
-void get_mem(){
-  int w, count = 0;
+  m->image.entry = h.entry;
+  for( uint32_t i = 0; i < h.num_segments; i++ ){
+    struct image_segment s;
+    memcpy( &s, buf + sizeof( h ) + i * sizeof( s ), sizeof( s ) );
+    if( ( s.addr & 3 ) || ( s.file_words > s.mem_words ) ||
+        ( (uint64_t)s.offset + 4 * (uint64_t)s.file_words > size ) ||
+        ( s.addr / 4 + (uint64_t)s.mem_words > (uint64_t)MEM_SIZE_IN_WORDS ) ){
+      fprintf( m->out, "bad image segment %u\n", i );
+      return -1;
+    }
+    int *words = malloc( s.file_words * sizeof( int ) + 1 );
+    memcpy( words, buf + s.offset, s.file_words * sizeof( int ) );
+    add_segment( &m->image, s.addr, s.file_words, s.mem_words - s.file_words, words );
+  }
+  return 0;
+}
 
-  if( verbose > 1 ) printf( "reading words in hex from stdin:\n" );
-  while( scanf( "%x", &w ) != EOF ){
-    if( verbose > 1 ) printf( "  0%08x\n", w );
-    if( count > INPUT_WORD_LIMIT ){
-      printf( "too many words loaded\n" );
-      exit( 0 );
+/* the -v listing of what was loaded */
+void list_image( struct machine *m ){
+  if( m->image.from_hex ){
+    fprintf( m->out, "reading words in hex from stdin:\n" );
+    for( int i = 0; i < m->image.segments[ 0 ].words; i++ ){
+      fprintf( m->out, "  0%08x\n", m->image.segments[ 0 ].data[ i ] );
+    }
+  }else{
+    fprintf( m->out, "reading image from stdin:\n" );
+    for( int i = 0; i < m->image.num_segments; i++ ){
+      struct segment *s = &m->image.segments[ i ];
+      fprintf( m->out, "  segment at %x: %u words, %u zero filled\n", s->addr, s->words, s->fill );
     }
-    mem[ count ] = w;
-    count++;
   }
-  if( verbose > 1 ) printf( "\n" );
+  fprintf( m->out, "\n" );
+}
+
+/* copy the image into memory, which is all zero, and start at its entry
+   point; zero-filled words need no page until they are touched */
+void install_image( struct machine *m ){
+  for( int i = 0; i < m->image.num_segments; i++ ){
+    struct segment *s = &m->image.segments[ i ];
+    for( int j = 0; j < s->words; j++ ) *mem_word( m, s->addr + 4 * j ) = s->data[ j ];
+  }
+  m->fip = m->image.entry;
+}
+
+/* load the program from in; returns 0, or -1 when it cannot be loaded,
+   having said why on m->out */
+int get_mem( struct machine *m, FILE *in ){
+  size_t size;
+  int mapped, status;
+  uint32_t magic = 0;
+  char *buf = read_input( in, &size, &mapped );
+
+  if( size >= sizeof( struct image_header ) ) memcpy( &magic, buf, 4 );
+  if( magic == IMAGE_MAGIC ){
+    status = parse_binary( m, buf, size );
+  }else{
+    status = parse_hex( m, buf, buf + size );
+  }
+
+  if( mapped ){
+    munmap( buf, size );
+  }else{
+    free( buf );
+  }
+  if( status ) return -1;
+  if( m->verbose > 1 ) list_image( m );
+  install_image( m );
+  return 0;
+}
+
+/* write the loaded program as a binary image */
+void write_image( struct machine *m, FILE *out ){
+  struct image_header h = { IMAGE_MAGIC, IMAGE_VERSION, m->image.entry, m->image.num_segments };
+  uint32_t offset = sizeof( h ) + h.num_segments * sizeof( struct image_segment );
+
+  fwrite( &h, sizeof( h ), 1, out );
+  for( int i = 0; i < m->image.num_segments; i++ ){
+    struct segment *s = &m->image.segments[ i ];
+    struct image_segment is = { s->addr, s->words, s->words + s->fill, offset };
+    fwrite( &is, sizeof( is ), 1, out );
+    offset += s->words * sizeof( int );
+  }
+  for( int i = 0; i < m->image.num_segments; i++ ){
+    fwrite( m->image.segments[ i ].data, sizeof( int ), m->image.segments[ i ].words, out );
+  }
 }
 
-void read_mem( int eff_addr, int reg_index ){
+void read_mem( struct machine *m, int eff_addr, int reg_index ){
+  if( m->mc ){
+    /* the page is found first, so a core never runs out of memory with
+       the bus held */
+    int *word = mem_word( m, eff_addr );
+    pthread_mutex_lock( &m->mc->bus );
+    coherent_access( m, eff_addr, 0 );
+    m->reg[ reg_index ] = *word;
+    pthread_mutex_unlock( &m->mc->bus );
+    m->memory_reads++;
+    return;
+  }
+
   // Access the cache with the eff_addr for a read operation indicated by 0, where "read" is zero
-  cache_access(eff_addr, 0);
+  cache_access(&m->cache, eff_addr, 0);
 
-  int word_addr = eff_addr >> 2;
-  if( verbose ) printf( "  read access at address %x\n", eff_addr );
-  assert( ( word_addr >= 0 ) && ( word_addr < MEM_SIZE_IN_WORDS ) );
-  reg[ reg_index ] = mem[ word_addr ];
-  memory_reads++;
+  if( m->verbose ) fprintf( m->out, "  read access at address %x\n", eff_addr );
+  m->reg[ reg_index ] = *mem_word( m, eff_addr );
+  m->memory_reads++;
 }
 
-void write_mem( int eff_addr, int reg_index ){
-  // Access the cache with the eff_addr for a read operation indicated by 1, and write is defined by one
-  cache_access(eff_addr, 1);
+void write_mem( struct machine *m, int eff_addr, int reg_index ){
+  struct page *p = mem_page( m, eff_addr );
+
+  if( m->mc ){
+    pthread_mutex_lock( &m->mc->bus );
+    coherent_access( m, eff_addr, 1 );
+  }else{
+    // Access the cache with the eff_addr for a read operation indicated by 1, and write is defined by one
+    cache_access(&m->cache, eff_addr, 1);
+  }
 
-  int word_addr = eff_addr >> 2;
-  if( verbose ) printf( "  write access at address %x\n", eff_addr );
-  assert( ( word_addr >= 0 ) && ( word_addr < MEM_SIZE_IN_WORDS ) );
-  mem[ word_addr ] = reg[ reg_index ];
-  memory_writes++;
+  if( m->verbose ) fprintf( m->out, "  write access at address %x\n", eff_addr );
+  p->word[ ( eff_addr >> 2 ) & ( PAGE_WORDS - 1 ) ] = m->reg[ reg_index ];
+  p->dirty = 1;
+  if( m->mc ){
+    /* every core's record, which the core may be reading without the lock */
+    for( int k = 0; k < m->mc->num_cores; k++ ){
+      __atomic_store_n( &p->decoded[ k * PAGE_WORDS + ( ( eff_addr >> 2 ) & ( PAGE_WORDS - 1 ) ) ].valid, 0, __ATOMIC_RELAXED );
+    }
+  }else if( p->decoded ){
+    p->decoded[ ( eff_addr >> 2 ) & ( PAGE_WORDS - 1 ) ].valid = 0;
+  }
+  if( m->jit ) jit_note_store( m, eff_addr );
+  if( m->mc ) pthread_mutex_unlock( &m->mc->bus );
+  m->memory_writes++;
 }
 
-void decode(){
-  op1    = ( ir >> 26 ) & 0x3f;
-  d      = ( ir >> 16 ) & 0x1f;
-  s1     = ( ir >> 11 ) & 0x1f;
-  s2     = ( ir >> 21 ) & 0x1f;
-  genset =   ir         & 0xffff;
+void decode( struct machine *m ){
+  m->op1    = ( m->ir >> 26 ) & 0x3f;
+  m->d      = ( m->ir >> 16 ) & 0x1f;
+  m->s1     = ( m->ir >> 11 ) & 0x1f;
+  m->s2     = ( m->ir >> 21 ) & 0x1f;
+  m->genset =   m->ir         & 0xffff;
 }
 
 // stop
-void halt(){
-  if( verbose ) printf( "halt\n" );
-  halt_flag = 1;
+void halt( struct machine *m ){
+  if( m->verbose ) fprintf( m->out, "halt\n" );
+  m->halt_flag = 1;
 }
 
 // load, general
-void imm_ld(){ 
-    eff_addr = ((reg[s1] + reg[s2]) << 16) >> 16;
+void imm_ld( struct machine *m ){ 
+    m->eff_addr = ((m->reg[m->s1] + m->reg[m->s2]) << 16) >> 16;
 
-    if (verbose) printf("ld.l  r%x(r%x),r%x\n", s1, s2, d);
+    if (m->verbose) fprintf(m->out, "ld.l  r%x(r%x),r%x\n", m->s1, m->s2, m->d);
   
-    read_mem(eff_addr, d);
+    read_mem(m, m->eff_addr, m->d);
 }
 
 // load, immediate
-void imm_ldi(){
+void imm_ldi( struct machine *m ){
     // sign extend genset
-    if (verbose) printf("ld.l  %x(r%x),r%x\n", genset, s2, d);
-    genset &= 0xFFFE;
+    if (m->verbose) fprintf(m->out, "ld.l  %x(r%x),r%x\n", m->genset, m->s2, m->d);
+    m->genset &= 0xFFFE;
 
     // add genset to s2 & store in eff_addr
-    eff_addr = (short)(genset + reg[s2]);
+    m->eff_addr = (short)(m->genset + m->reg[m->s2]);
 
-    read_mem(eff_addr, d);
+    read_mem(m, m->eff_addr, m->d);
 }
 
 // store, general
-void imm_st(){
-  int beg16 = (ir & 0xffff) & 0xf;
+void imm_st( struct machine *m ){
+  int beg16 = (m->ir & 0xffff) & 0xf;
 
-  if(verbose) { printf( "st.l  r%x,%x(r%x)\n", s1, beg16, s2 ); }
+  if(m->verbose) { fprintf( m->out, "st.l  r%x,%x(r%x)\n", m->s1, beg16, m->s2 ); }
   // effectively clearing the LSB
-  if(((ir >> 28) & 1) == true && (ir & 1) == true){ beg16 = (beg16 | 1) - 1; }
+  if(((m->ir >> 28) & 1) == true && (m->ir & 1) == true){ beg16 = (beg16 | 1) - 1; }
 
-  eff_addr = (short)(beg16 + reg[s2]);
+  m->eff_addr = (short)(beg16 + m->reg[m->s2]);
 
-  write_mem(eff_addr, s1);
+  write_mem(m, m->eff_addr, m->s1);
 
 }
 
+// The condition code of adds and subs comes from the registers after the
+// result is written, so a destination that is also a source changes it.
+// Every engine's copy of these instructions keeps that order.
+
 // add, general, signed
-void adds(){ 
+void adds( struct machine *m ){ 
     // add the two source registers & store in destination register
-    int sign1 = reg[s1];
-    int sign2 = reg[s2];
+    int sign1 = m->reg[m->s1];
+    int sign2 = m->reg[m->s2];
     int result = sign1 + sign2;
-    if( verbose ) printf( "adds  r%x,r%x,r%x\n", s1, s2, d );
-    reg[ d ] = result;
+    if( m->verbose ) fprintf( m->out, "adds  r%x,r%x,r%x\n", m->s1, m->s2, m->d );
+    m->reg[ m->d ] = result;
 
     // set cc_bit to two's complement of sign2
-    int verify = (~reg[s1] + 1);
-    cc_bit = (sign2 < verify) ? 1 : 0;
+    int verify = (~m->reg[m->s1] + 1);
+    m->cc_bit = (sign2 < verify) ? 1 : 0;
 }
 
 // add, immediate, signed
-void imm_adds(){ 
-    if (verbose ) printf( "adds  %x,r%x,r%x\n", genset, s2, d );
+void imm_adds( struct machine *m ){ 
+    if (m->verbose ) fprintf( m->out, "adds  %x,r%x,r%x\n", m->genset, m->s2, m->d );
 
     // sign extend genset
-    int16_t sign_extention = (int16_t)genset; 
+    int16_t sign_extention = (int16_t)m->genset; 
 
-    reg[d] = reg[s2] + sign_extention;  
+    m->reg[m->d] = m->reg[m->s2] + sign_extention;  
 
     int testing_cc_bit = (~sign_extention) + 1;
-    cc_bit = (reg[s2] < testing_cc_bit) ? 1 : 0;
+    m->cc_bit = (m->reg[m->s2] < testing_cc_bit) ? 1 : 0;
 }
 
 // subtract, general, signed
-void subs(){ 
-    if(verbose) printf("subs  r%x,r%x,r%x\n", s1, s2, d);
-    int src1_value = reg[s1];
-    int src2 = reg[s2];
+void subs( struct machine *m ){ 
+    if(m->verbose) fprintf(m->out, "subs  r%x,r%x,r%x\n", m->s1, m->s2, m->d);
+    int src1_value = m->reg[m->s1];
+    int src2 = m->reg[m->s2];
     int result = src1_value - src2;
     
-    reg[d] = result;
+    m->reg[m->d] = result;
 
     // set cc_bit to two's complement of src2
-    cc_bit = (reg[s2] > reg[s1]) ? 1 : 0;
+    m->cc_bit = (m->reg[m->s2] > m->reg[m->s1]) ? 1 : 0;
 
 }
 
 // subtract, immediate, signed
-void imm_subs() { 
-    printf("subs  %x,r%x,r%x\n", genset, s2, d); 
+void imm_subs( struct machine *m ) { 
+    fprintf(m->out, "subs  %x,r%x,r%x\n", m->genset, m->s2, m->d); 
 
     // 16 bit sign extension
-    int16_t sign_extended_genset = (int16_t)genset; 
+    int16_t sign_extended_genset = (int16_t)m->genset; 
 
-    reg[d] = sign_extended_genset - reg[s2]; 
-    cc_bit = (reg[s2] > sign_extended_genset) ? 1 : 0;
+    m->reg[m->d] = sign_extended_genset - m->reg[m->s2]; 
+    m->cc_bit = (m->reg[m->s2] > sign_extended_genset) ? 1 : 0;
+}
+
+/* a branch with a displacement of zero is a broken program.  It fails
+   the assert it always has, but under -j it only halts the job */
+__attribute__(( cold )) void zero_displacement( struct machine *m ){
+  if( !m->job ) assert( !"zero branch displacement" );
+  fprintf( m->out, "zero branch displacement at %x\n", m->xip );
+  m->halt_flag = 1;
 }
 
 // branch
-void br(){ 
+void br( struct machine *m ){ 
   // get the 16 bits from the instruction & shift them to the right
-  int displace_16_bits = ir & 0x03ffffff; 
-  assert( displace_16_bits != 0 );
-  if( verbose ) printf( "br    %x", displace_16_bits );
+  int displace_16_bits = m->ir & 0x03ffffff; 
+  if( displace_16_bits == 0 ){
+    zero_displacement( m );
+    return;
+  }
+  if( m->verbose ) fprintf( m->out, "br    %x", displace_16_bits );
   
   displace_16_bits = (displace_16_bits << 6) >> 6;
 
   // add the 16 bits to the fip
-  fip = fip + ( displace_16_bits << 2 );
+  m->fip = m->fip + ( displace_16_bits << 2 );
 
-  if( verbose ){
+  if( m->verbose ){
     if( ( displace_16_bits < 0 ) || ( displace_16_bits > 9 ) ){
-        printf( " (= decimal %d)\n", displace_16_bits );
+        fprintf( m->out, " (= decimal %d)\n", displace_16_bits );
   }
     else{
-      printf( "\n" );
+      fprintf( m->out, "\n" );
     }
   }
 
-  branches++;
-  taken++;
+  m->branches++;
+  m->taken++;
 }
 
 // branch if not equal
-void btne() {
-    int displace_16_bits = (((ir >> 16) & 0x1f) << 11) | (ir & 0x7ff); 
-    if (verbose) printf("btne  r%x,r%x,%x", s1, s2, displace_16_bits); 
-    branches++;
+void btne( struct machine *m ) {
+    int displace_16_bits = (((m->ir >> 16) & 0x1f) << 11) | (m->ir & 0x7ff); 
+    if (m->verbose) fprintf(m->out, "btne  r%x,r%x,%x", m->s1, m->s2, displace_16_bits); 
+    m->branches++;
 
     displace_16_bits = ((displace_16_bits << 16) >> 16);
 
     // if the two source registers are not equal, add the 16 bits to the fip
-    if (verbose) {
+    if (m->verbose) {
         if (displace_16_bits < 0 || displace_16_bits > 9) {
-            printf(" (= decimal %d)\n", displace_16_bits); 
+            fprintf(m->out, " (= decimal %d)\n", displace_16_bits); 
         } else {
-            printf("\n"); 
+            fprintf(m->out, "\n"); 
         }
     }
 
-    if (reg[s1] != reg[s2]) 
+    if (m->reg[m->s1] != m->reg[m->s2]) 
     {
-      fip += (displace_16_bits << 2);
-      taken++;
+      m->fip += (displace_16_bits << 2);
+      m->taken++;
     }
 }
 
 // branch if not equal, immediate
-void btnei() {
+void btnei( struct machine *m ) {
     // get the 5 bits from the instruction & shift them to the right
-    int shift = (ir >> 11) & 0x1f; 
-    int displace_16_bits  = (((ir >> 16) & 0x1f) << 11) | (ir & 0x7ff); 
-    assert(displace_16_bits  != 0); 
+    int shift = (m->ir >> 11) & 0x1f; 
+    int displace_16_bits  = (((m->ir >> 16) & 0x1f) << 11) | (m->ir & 0x7ff); 
+    if (displace_16_bits == 0) {
+        zero_displacement(m);
+        return;
+    }
 
-    branches++;
+    m->branches++;
     
-    if (verbose) printf("btnei %x,r%x,%x", shift, s2, displace_16_bits );
+    if (m->verbose) fprintf(m->out, "btnei %x,r%x,%x", shift, m->s2, displace_16_bits );
     
     // shift the 16 bits to the right
     displace_16_bits  = ((displace_16_bits  << 16) >> 16); 
 
-    if (verbose) {
+    if (m->verbose) {
         if (displace_16_bits  < 0 || displace_16_bits  > 9) {
-            printf(" (= decimal %d)\n", displace_16_bits ); 
+            fprintf(m->out, " (= decimal %d)\n", displace_16_bits ); 
         } else {
-            printf("\n"); 
+            fprintf(m->out, "\n"); 
         }
     }
-    if (shift != reg[s2]) {
-      fip = fip + (displace_16_bits  << 2); 
-      taken++;
+    if (shift != m->reg[m->s2]) {
+      m->fip = m->fip + (displace_16_bits  << 2); 
+      m->taken++;
     }
 }
 
 // branch if equal
-void bte() {
-    int displace_16_bits  = (((ir >> 16) & 0x1f) << 11) | (ir & 0x7ff); 
-    assert(displace_16_bits  != 0);
+void bte( struct machine *m ) {
+    int displace_16_bits  = (((m->ir >> 16) & 0x1f) << 11) | (m->ir & 0x7ff); 
+    if (displace_16_bits == 0) {
+        zero_displacement(m);
+        return;
+    }
 
-    branches++;
-    if (reg[s1] != reg[s2]) return;
+    m->branches++;
+    if (m->reg[m->s1] != m->reg[m->s2]) return;
 
     displace_16_bits  = ((displace_16_bits  << 16) >> 16); 
 
    
-    fip += (displace_16_bits  << 2); 
+    m->fip += (displace_16_bits  << 2); 
 
-    taken++;
+    m->taken++;
 
     // get the 16 bits from the instruction & shift them to the right
-    if (verbose) {
-        printf("bte   r%x,r%x,%x", s1, s2, displace_16_bits ); 
+    if (m->verbose) {
+        fprintf(m->out, "bte   r%x,r%x,%x", m->s1, m->s2, displace_16_bits ); 
         if (displace_16_bits  < 0 || displace_16_bits  > 9) {
-            printf(" (= decimal %d)\n", displace_16_bits ); 
+            fprintf(m->out, " (= decimal %d)\n", displace_16_bits ); 
         } else {
-            printf("\n"); 
+            fprintf(m->out, "\n"); 
         }
     }
 }
 
 // branch if equal, immediate
-void btei() {
-    int shift = (ir >> 11) & 0x1f;
-    int displace_16_bits = (((ir >> 16) & 0x1f) << 11) | (ir & 0x7ff);
+void btei( struct machine *m ) {
+    int shift = (m->ir >> 11) & 0x1f;
+    int displace_16_bits = (((m->ir >> 16) & 0x1f) << 11) | (m->ir & 0x7ff);
 
-    assert(displace_16_bits != 0);
+    if (displace_16_bits == 0) {
+        zero_displacement(m);
+        return;
+    }
 
-    branches++;
+    m->branches++;
 
-        if (verbose) printf("btei  %x,r%x,%x", shift, s2, displace_16_bits); 
-        
+    if (m->verbose) fprintf(m->out, "btei  %x,r%x,%x", shift, m->s2, displace_16_bits); 
 
-    if (verbose) {
-        if (displace_16_bits < 0 || displace_16_bits > 9) { 
-            displace_16_bits = ((displace_16_bits << 16) >> 16); 
+    // sign extend in every mode, as the other compare branches do; this
+    // used to happen only when tracing, so quiet runs took another target
+    displace_16_bits = ((displace_16_bits << 16) >> 16); 
 
-            printf(" (= decimal %d)\n", displace_16_bits);
-        } 
-        
-        else printf("\n");
-        
+    if (m->verbose) {
+        if (displace_16_bits < 0 || displace_16_bits > 9) {
+            fprintf(m->out, " (= decimal %d)\n", displace_16_bits);
+        } else {
+            fprintf(m->out, "\n"); 
+        }
     }
 
     // when the register equals the shift, add the 16 bits to the fip
-    if (shift == reg[s2]) {
-    fip += (displace_16_bits << 2);
+    if (shift == m->reg[m->s2]) {
+    m->fip += (displace_16_bits << 2);
   
-    taken++;
+    m->taken++;
   }
 }
 
 // branch if carry
-void bc() {
+void bc( struct machine *m ) {
     // terminate is cc is 0
-    if (cc_bit != 1) {
-        branches++;
+    if (m->cc_bit != 1) {
+        m->branches++;
         return; 
     }
 
     // ir & 0x03ffffff gets the 26 bits from the instruction
-    int displace_16_bits = ir & 0x03ffffff;
-    assert(displace_16_bits != 0);
+    int displace_16_bits = m->ir & 0x03ffffff;
+    if (displace_16_bits == 0) {
+        zero_displacement(m);
+        return;
+    }
 
     displace_16_bits = ((displace_16_bits << 6) >> 6);
 
-    if (verbose) {
-        printf("bc    %x", displace_16_bits);
-        printf((displace_16_bits < 0 || displace_16_bits > 9) ? " (= decimal %d)\n" : "\n", displace_16_bits);
+    if (m->verbose) {
+        fprintf(m->out, "bc    %x", displace_16_bits);
+        fprintf(m->out, (displace_16_bits < 0 || displace_16_bits > 9) ? " (= decimal %d)\n" : "\n", displace_16_bits);
     }
 
-    fip += (displace_16_bits << 2);
+    m->fip += (displace_16_bits << 2);
 
-    branches++;
-    taken++;
+    m->branches++;
+    m->taken++;
 }
 
 // branch if not carry
-void bnc() {
-    branches++; 
-
-    if (cc_bit != 0) return;
+void bnc( struct machine *m ) {
+    if (m->cc_bit != 0) {
+        m->branches++;
+        return;
+    }
 
     // ir & 0x03ffffff gets the 26 bits from the instruction
-    int displace_16_bits = ir & 0x03ffffff;
-    assert(displace_16_bits != 0); 
+    int displace_16_bits = m->ir & 0x03ffffff;
+    if (displace_16_bits == 0) {
+        zero_displacement(m);
+        return;
+    }
 
-    if (verbose) printf("bnc   %x", displace_16_bits);
+    if (m->verbose) fprintf(m->out, "bnc   %x", displace_16_bits);
     
     displace_16_bits = ((displace_16_bits << 6) >> 6); 
 
-    taken++;
+    m->branches++;
+    m->taken++;
 
     
-    fip += (displace_16_bits << 2); 
+    m->fip += (displace_16_bits << 2); 
 
-    if (verbose) printf((displace_16_bits < 0 || displace_16_bits > 9) ? " (= decimal %d)\n" : "\n", displace_16_bits);
+    if (m->verbose) fprintf(m->out, (displace_16_bits < 0 || displace_16_bits > 9) ? " (= decimal %d)\n" : "\n", displace_16_bits);
     
 }
 
 // shift left
-void shl() {
+void shl( struct machine *m ) {
   
-    if (verbose) printf("shl   r%x,r%x,r%x\n", s1, s2, d);
-    int src1_value = reg[s1];
-    int src2 = reg[s2];
+    if (m->verbose) fprintf(m->out, "shl   r%x,r%x,r%x\n", m->s1, m->s2, m->d);
+    int src1_value = m->reg[m->s1];
+    int src2 = m->reg[m->s2];
     int result = src2 << src1_value;
     
-    reg[d] = result;
+    m->reg[m->d] = result;
 }
 
 // shift left, immediate
-void shli() {
-    if (verbose)  printf("shli  %x,r%x,r%x\n", genset, s2, d);
+void shli( struct machine *m ) {
+    if (m->verbose)  fprintf(m->out, "shli  %x,r%x,r%x\n", m->genset, m->s2, m->d);
     
-    int src2 = reg[s2];
-    int result = src2 << genset;
+    int src2 = m->reg[m->s2];
+    int result = src2 << m->genset;
 
-    reg[d] = result;
+    m->reg[m->d] = result;
 }
 
 // shift right
-void shr(){
+void shr( struct machine *m ){
 
-  printf( "shr   r%x,r%x,r%x\n", s1, s2, d );
-    unsigned int valueToShift = reg[s2];
-    unsigned int positionsToShift = reg[s1];
+  fprintf( m->out, "shr   r%x,r%x,r%x\n", m->s1, m->s2, m->d );
+    unsigned int valueToShift = m->reg[m->s2];
+    unsigned int positionsToShift = m->reg[m->s1];
     unsigned int result = valueToShift >> positionsToShift;
 
-    reg[d] = result;
+    m->reg[m->d] = result;
 
 }
 
 // shift right, immediate
-void shri() {
-    if (verbose) printf("shri  %x,r%x,r%x\n", genset, s2, d);
-    int src2 = reg[s2];
-    int result = src2 >> genset;
+void shri( struct machine *m ) {
+    if (m->verbose) fprintf(m->out, "shri  %x,r%x,r%x\n", m->genset, m->s2, m->d);
+    int src2 = m->reg[m->s2];
+    int result = src2 >> m->genset;
 
-    reg[d] = result;
+    m->reg[m->d] = result;
 }
 
 // shift right arithmetic
-void shra() {
-  if (verbose) printf("shra  r%x,r%x,r%x\n", s1, s2, d);
-  int src1 = reg[s1];
-  int src2 = reg[s2];
+void shra( struct machine *m ) {
+  if (m->verbose) fprintf(m->out, "shra  r%x,r%x,r%x\n", m->s1, m->s2, m->d);
+  int src1 = m->reg[m->s1];
+  int src2 = m->reg[m->s2];
   int result = src2 >> src1;
-  reg[d] = result;
+  m->reg[m->d] = result;
 }
 
 // shift right arithmetic, immediate
-void shrai() {
-  if (verbose) printf("shrai %x,r%x,r%x\n", genset, s2, d);
-  reg[d] = reg[s2] >> genset;
+void shrai( struct machine *m ) {
+  if (m->verbose) fprintf(m->out, "shrai %x,r%x,r%x\n", m->genset, m->s2, m->d);
+  m->reg[m->d] = m->reg[m->s2] >> m->genset;
 }
 
 // unknown instruction
-void unknown_op(){
-  printf( "unknown instruction %08x\n", ir );
-  printf( " op1=%x",  op1 );
-  printf( " d=%x",    d );
-  printf( " s1=%x",   s1 );
-  printf( " s2=%x\n", s2 );
-  printf( "program terminates\n" );
+void unknown_op( struct machine *m ){
+  fprintf( m->out, "unknown instruction %08x\n", m->ir );
+  fprintf( m->out, " op1=%x",  m->op1 );
+  fprintf( m->out, " d=%x",    m->d );
+  fprintf( m->out, " s1=%x",   m->s1 );
+  fprintf( m->out, " s2=%x\n", m->s2 );
+  fprintf( m->out, "program terminates\n" );
   exit( -1 );
 }
 
-/* Cache stats */
-void cache_init( void ){
-  for (int i = 0; i < LINES_PER_BANK; i++) { plru_state[i] = 0; }
-    for (int i = 0; i < LINES_PER_BANK; i++) {
-        for (int j = 0; j < NUM_BANKS; j++) {
-            valid[i][j] = 0;
-            dirty[i][j] = 0;
-            tag[i][j] = 0;
-        }
+int log2_int( unsigned int n ){
+  int bits = 0;
+  while( ( 1u << bits ) < n ) bits++;
+  return bits;
+}
+
+/* empty the cache and zero its counters */
+void cache_init( struct cache *c ){
+  memset( c->data, 0, c->sets * c->set_words * sizeof( uint64_t ) );
+  memset( c->rank, 0, c->sets * c->ways );
+  c->psel = PSEL_MAX / 2;
+  c->seed = 1;
+  c->cache_reads = c->cache_writes = c->hits = c->misses = c->write_backs = 0;
+}
+
+/* whether the cache can have this geometry: each a power of two, with
+   lines of at least a word, at most MAX_WAYS ways and at most 1 GB */
+int cache_geometry_ok( unsigned int sets, unsigned int ways, unsigned int line_size ){
+  return sets && ways && line_size && !( sets & ( sets - 1 ) ) && !( ways & ( ways - 1 ) ) &&
+         !( line_size & ( line_size - 1 ) ) && ( line_size >= 4 ) && ( ways <= MAX_WAYS ) &&
+         ( (uint64_t)sets * ways * line_size <= ( 1u << 30 ) );
+}
+
+/* give the cache a geometry that cache_geometry_ok() accepts, and empty
+   it */
+void cache_configure( struct cache *c, unsigned int sets, unsigned int ways, unsigned int line_size ){
+  cache_free( c );
+  c->sets        = sets;
+  c->ways        = ways;
+  c->line_size   = line_size;
+  c->offset_bits = log2_int( line_size );
+  c->tag_shift   = c->offset_bits + log2_int( sets );
+  c->set_words   = SET_TAGS + ( ways + 1 ) / 2;
+  c->data  = malloc( sets * c->set_words * sizeof( uint64_t ) );
+  c->touch = malloc( 2 * ways * sizeof( uint64_t ) );
+  c->rank  = malloc( sets * ways );
+  if( !c->data || !c->touch || !c->rank ) out_of_memory();
+  for( unsigned int way = 0; way < ways; way++ ){
+    c->touch[ 2 * way ] = c->touch[ 2 * way + 1 ] = 0;
+    for( unsigned int node = way + ways; node > 1; node >>= 1 ){
+      c->touch[ 2 * way + !( node & 1 ) ] |= 1ull << ( node >> 1 );
     }
+  }
+  cache_init( c );
+}
 
-    cache_reads = cache_writes = hits = misses = write_backs = 0;
+void cache_free( struct cache *c ){
+  free( c->data );
+  free( c->touch );
+  free( c->rank );
+  c->data = c->touch = NULL;
+  c->rank = NULL;
 }
 
-void cache_stats( void ){
-  printf( "cache statistics (in decimal):\n" );
-  printf( "  cache reads       = %d\n", cache_reads );
-  printf( "  cache writes      = %d\n", cache_writes );
-  printf( "  cache hits        = %d\n", hits );
-  printf( "  cache misses      = %d\n", misses );
-  printf( "  cache write backs = %d\n", write_backs );
+/* make dst a copy of src, contents and counters included */
+void cache_copy( struct cache *dst, struct cache *src ){
+  cache_configure( dst, src->sets, src->ways, src->line_size );
+  memcpy( dst->data, src->data, src->sets * src->set_words * sizeof( uint64_t ) );
+  memcpy( dst->rank, src->rank, src->sets * src->ways );
+  dst->policy       = src->policy;
+  dst->psel         = src->psel;
+  dst->seed         = src->seed;
+  dst->cache_reads  = src->cache_reads;
+  dst->cache_writes = src->cache_writes;
+  dst->hits         = src->hits;
+  dst->misses       = src->misses;
+  dst->write_backs  = src->write_backs;
+  dst->off          = src->off;
 }
 
+void level_stats( struct cache *c, const char *name, FILE *out ){
+  fprintf( out, "%s statistics (in decimal):\n", name );
+  fprintf( out, "  cache reads       = %d\n", c->cache_reads );
+  fprintf( out, "  cache writes      = %d\n", c->cache_writes );
+  fprintf( out, "  cache hits        = %d\n", c->hits );
+  fprintf( out, "  cache misses      = %d\n", c->misses );
+  fprintf( out, "  cache write backs = %d\n", c->write_backs );
+}
 
-/* address is byte address, type is read (=0) or write (=1) */
+void cache_stats( struct cache *c, FILE *out ){
+  level_stats( c, "cache", out );
+}
+
+unsigned int cache_set( struct cache *c, unsigned int address ){
+  return ( address >> c->offset_bits ) & ( c->sets - 1 );
+}
+
+/* the entry of a valid line holding address */
+unsigned int cache_entry( struct cache *c, unsigned int address ){
+  return ( ( address >> c->tag_shift ) << 1 ) | 1;
+}
+
+uint64_t *cache_block( struct cache *c, unsigned int set ){
+  return c->data + set * c->set_words;
+}
+
+unsigned int *block_entries( uint64_t *block ){
+  return (unsigned int *)( block + SET_TAGS );
+}
+
+/* a bit for each of the first ways entries that equals key.  With SSE2
+   four entries are compared at once, and with AVX2 eight; the loops
+   unroll when ways is a constant */
+static inline __attribute__(( always_inline ))
+uint64_t match_ways( const unsigned int *entries, unsigned int key, const unsigned int ways ){
+  uint64_t match = 0;
+  unsigned int way = 0;
+
+#ifdef __AVX2__
+  __m256i k8 = _mm256_set1_epi32( key );
+#pragma GCC unroll 8
+  for( ; way + 8 <= ways; way += 8 ){
+    __m256i e = _mm256_loadu_si256( (const __m256i *)( entries + way ) );
+    match |= (uint64_t)(unsigned int)_mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( e, k8 ) ) ) << way;
+  }
+#endif
+#ifdef __SSE2__
+  __m128i k4 = _mm_set1_epi32( key );
+#pragma GCC unroll 16
+  for( ; way + 4 <= ways; way += 4 ){
+    __m128i e = _mm_loadu_si128( (const __m128i *)( entries + way ) );
+    match |= (uint64_t)(unsigned int)_mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( e, k4 ) ) ) << way;
+  }
+#endif
+#pragma GCC unroll 4
+  for( ; way < ways; way++ ) match |= (uint64_t)( entries[ way ] == key ) << way;
+  return match;
+}
+
+/* line holding address in the cache, or -1 */
+int cache_find( struct cache *c, unsigned int address ){
+  unsigned int set = cache_set( c, address );
+  uint64_t hit = match_ways( block_entries( cache_block( c, set ) ), cache_entry( c, address ), c->ways );
+
+  return hit ? (int)( set * c->ways + __builtin_ctzll( hit ) ) : -1;
+}
+
+/* the state of one line, by number */
+
+unsigned int *line_entry( struct cache *c, unsigned int line ){
+  return &block_entries( cache_block( c, line / c->ways ) )[ line % c->ways ];
+}
+
+int line_valid( struct cache *c, unsigned int line ){
+  return *line_entry( c, line ) != 0;
+}
+
+int line_dirty( struct cache *c, unsigned int line ){
+  return ( cache_block( c, line / c->ways )[ SET_DIRTY ] >> ( line % c->ways ) ) & 1;
+}
+
+void line_set_dirty( struct cache *c, unsigned int line, int dirty ){
+  uint64_t *block = cache_block( c, line / c->ways ), bit = 1ull << ( line % c->ways );
+  block[ SET_DIRTY ] = ( block[ SET_DIRTY ] & ~bit ) | ( dirty ? bit : 0 );
+}
+
+/* an empty line is never dirty, so that write backs can be counted
+   without looking at the entry */
+void line_invalidate( struct cache *c, unsigned int line ){
+  *line_entry( c, line ) = 0;
+  line_set_dirty( c, line, 0 );
+}
+
+/* the way the tree bits of a set point to */
+unsigned int plru_victim( uint64_t bits, unsigned int ways ){
+  unsigned int node = 1;
+  while( node < ways ) node = 2 * node + ( ( bits >> node ) & 1 );
+  return node - ways;
+}
+
+/* point the bits on way's path away from it: a node reached from its
+   left child points right */
+uint64_t plru_touch( struct cache *c, uint64_t bits, unsigned int way ){
+  return ( bits & ~c->touch[ 2 * way ] ) | c->touch[ 2 * way + 1 ];
+}
+
+const char *policy_names[NUM_POLICIES] = { "plru", "lru", "fifo", "random", "nru", "srrip", "brrip", "drrip" };
+
+unsigned int cache_random( struct cache *c ){
+  c->seed ^= c->seed << 13;
+  c->seed ^= c->seed >> 17;
+  c->seed ^= c->seed << 5;
+  return c->seed;
+}
+
+/* the way of a full set to replace.  Besides PLRU the policies are
+
+     lru     rank is the age: 0 for the set's most recent line
+     fifo    the same, but only a fill makes a line the youngest
+     random  any way, from the cache's own generator
+     nru     rank is a reference bit, and the victim the first line
+             without it; when every line has it, all but the line just
+             referenced lose it
+     srrip   rank is the predicted re-reference interval, 0 to 3: a hit
+             sets it to 0 and a fill to 2, and the victim is the first
+             line at 3, after ageing the set until one is
+     brrip   srrip, but a fill sets 3, and 2 only one time in 32
+     drrip   srrip or brrip by set dueling: the first set of each
+             period of sets always uses srrip and the last brrip, a miss
+             in either moves psel towards the other, and the remaining
+             sets follow the one psel favours */
+unsigned int policy_victim( struct cache *c, unsigned int set ){
+  unsigned char *rank = c->rank + set * c->ways;
+  unsigned int ways = c->ways, way, oldest = 0;
+
+  switch( c->policy ){
+    case POLICY_PLRU:
+      return plru_victim( cache_block( c, set )[ SET_PLRU ], ways );
+    case POLICY_LRU:
+    case POLICY_FIFO:
+      for( way = 1; way < ways; way++ ){
+        if( rank[ way ] > rank[ oldest ] ) oldest = way;
+      }
+      return oldest;
+    case POLICY_RANDOM:
+      return cache_random( c ) & ( ways - 1 );
+    case POLICY_NRU:
+      for( way = 0; way < ways; way++ ){
+        if( !rank[ way ] ) return way;
+      }
+      return 0;
+  }
+  for( ;; ){
+    for( way = 0; way < ways; way++ ){
+      if( rank[ way ] >= RRPV_MAX ) return way;
+    }
+    for( way = 0; way < ways; way++ ) rank[ way ]++;
+  }
+}
+
+/* update the replacement state of a set for an access to way, which
+   has just been filled if fill is set */
+void policy_touch( struct cache *c, unsigned int set, unsigned int way, int fill ){
+  unsigned char *rank = c->rank + set * c->ways;
+  unsigned int ways = c->ways, age, policy = c->policy, period, leader;
+
+  switch( policy ){
+    case POLICY_PLRU: {
+      uint64_t *block = cache_block( c, set );
+      block[ SET_PLRU ] = plru_touch( c, block[ SET_PLRU ], way );
+      return;
+    }
+    case POLICY_FIFO:
+      if( !fill ) return;
+      /* fall through */
+    case POLICY_LRU:
+      /* a filled line counts as the oldest, which keeps the ages of a
+         set a permutation once it is full */
+      age = fill ? ways - 1 : rank[ way ];
+      for( unsigned int v = 0; v < ways; v++ ){
+        if( rank[ v ] < age ) rank[ v ]++;
+      }
+      rank[ way ] = 0;
+      return;
+    case POLICY_RANDOM:
+      return;
+    case POLICY_NRU:
+      rank[ way ] = 1;
+      for( unsigned int v = 0; v < ways; v++ ){
+        if( !rank[ v ] ) return;
+      }
+      for( unsigned int v = 0; v < ways; v++ ) rank[ v ] = ( v == way );
+      return;
+  }
+
+  if( !fill ){
+    rank[ way ] = 0;
+    return;
+  }
+  if( policy == POLICY_DRRIP ){
+    period = ( c->sets < DUEL_PERIOD ) ? c->sets : DUEL_PERIOD;
+    leader = set % period;
+    if( leader == 0 ){
+      if( c->psel < PSEL_MAX ) c->psel++;
+      policy = POLICY_SRRIP;
+    }else if( leader == period - 1 ){
+      if( c->psel > 0 ) c->psel--;
+      policy = POLICY_BRRIP;
+    }else{
+      policy = ( c->psel > PSEL_MAX / 2 ) ? POLICY_BRRIP : POLICY_SRRIP;
+    }
+  }
+  rank[ way ] = ( ( policy == POLICY_BRRIP ) && ( cache_random( c ) % BRRIP_LONG ) ) ? RRPV_MAX : RRPV_MAX - 1;
+}
 
-void cache_access( unsigned int address, unsigned int type ){
+/* one access to a cache of the given associativity.  It is expanded
+   for PLRU at the common associativities, where the compares of the
+   set's entries and the walk of its tree unroll */
+static inline __attribute__(( always_inline ))
+void access_ways( struct cache *c, unsigned int address, unsigned int type, const unsigned int ways,
+                  const int plru ){
 
   unsigned int
-    addr_tag,    /* tag bits of address                           */
-    addr_index,  /* index bits of address                         */
-    bank,        /* bank that hit, or bank chosen for replacement */
-    os = 4,      /* # of bits for offset                          */
-    id = 0x7,    /* 0111 for index                                */
-    tagoff = 7;  /* # of bits for                                 */
+    entry,       /* entry of the line holding address           */
+    addr_set,    /* index bits of address                       */
+    way,         /* way that hit, or way chosen for replacement */
+    *entries;
+  uint64_t *block, hit, empty, fill;
 
   if( type == 0 ){
-    cache_reads++;
+    c->cache_reads++;
   }else{
-    cache_writes++;
+    c->cache_writes++;
   }
 
-  // Right shift address by os and id 
-  // then discard the lower order bits
-  // then bitwise AND with id
-  addr_index = (address >> os) & id;
-  addr_tag = address >> tagoff; 
+  addr_set = cache_set( c, address );
+  entry    = cache_entry( c, address );
+  block    = c->data + addr_set * ( SET_TAGS + ( ways + 1 ) / 2 );
+  entries  = block_entries( block );
+
+  hit = match_ways( entries, entry, ways );
+  if( hit ){
+    c->hits++;
+    way = __builtin_ctzll( hit );
+
+  /* miss - fill the first empty way, or replace the policy's way */
+
+  }else{
+    c->misses++;
+
+    empty = match_ways( entries, 0, ways );
+    if( empty ){
+      way = __builtin_ctzll( empty );
+    }else{
+      way = plru ? plru_victim( block[ SET_PLRU ], ways ) : policy_victim( c, addr_set );
+    }
+
+    c->write_backs += ( block[ SET_DIRTY ] >> way ) & 1;   /* without a branch: it is unpredictable */
 
-  /* check bank 0 hit */
+    /* a line from an exclusive level below can arrive dirty */
+    fill = 0;
+    if( __builtin_expect( c->hier != NULL, 0 ) ) fill = hierarchy_fill( c, addr_set * ways + way, address );
+    block[ SET_DIRTY ] = ( block[ SET_DIRTY ] & ~( 1ull << way ) ) | ( fill << way );
+    entries[ way ] = entry;
+  }
 
-  if( valid[0][addr_index] && (addr_tag==tag[0][addr_index]) ){
-    hits++;
-    bank = 0;
+  /* update replacement state for this set */
 
-  /* check bank 1 hit */
+  if( plru ){
+    block[ SET_PLRU ] = plru_touch( c, block[ SET_PLRU ], way );
+  }else{
+    policy_touch( c, addr_set, way, !hit );
+  }
 
-  }else if( valid[1][addr_index] && (addr_tag==tag[1][addr_index]) ){
-    hits++;
-    bank = 1;
+  /* update dirty bit on a write */
 
-  /* check bank 2 hit */
+  if( type == 1 ) block[ SET_DIRTY ] |= 1ull << way;
+}
 
-  }else if( valid[2][addr_index] && (addr_tag==tag[2][addr_index]) ){
-    hits++;
-    bank = 2;
+#define ACCESS_WAYS( n ) \
+  void access_##n( struct cache *c, unsigned int address, unsigned int type ){ access_ways( c, address, type, n, 1 ); }
+ACCESS_WAYS( 1 )
+ACCESS_WAYS( 2 )
+ACCESS_WAYS( 4 )
+ACCESS_WAYS( 8 )
+ACCESS_WAYS( 16 )
+#undef ACCESS_WAYS
+
+void access_any( struct cache *c, unsigned int address, unsigned int type ){
+  access_ways( c, address, type, c->ways, 0 );
+}
 
-  /* check bank 3 hit */
+/* address is byte address, type is read (=0) or write (=1) */
 
-  }else if( valid[3][addr_index] && (addr_tag==tag[3][addr_index]) ){
-    hits++;
-    bank = 3;
+void cache_access( struct cache *c, unsigned int address, unsigned int type ){
+  if( c->off ) return;
 
-  /* miss - choose replacement bank */
+  switch( ( c->policy == POLICY_PLRU ) ? c->ways : 0 ){
+    case 1:  access_1( c, address, type );   break;
+    case 2:  access_2( c, address, type );   break;
+    case 4:  access_4( c, address, type );   break;
+    case 8:  access_8( c, address, type );   break;
+    case 16: access_16( c, address, type );  break;
+    default: access_any( c, address, type );
+  }
+}
 
+/* a cache hierarchy, for -H: split L1 instruction and data caches over
+   a unified L2 and an optional L3, with memory below the last level.
+   The machine's cache is L1D, and the instrumented engine sends each
+   instruction fetch to L1I.  A level below L1 is
+
+     inclusive      filled by misses from above; evicting a line also
+                    invalidates its copies in every level above
+     exclusive      filled only by lines evicted from above, clean or
+                    dirty; a hit moves the line up and out of the level
+     nine           neither: filled by misses from above and evicted
+                    without looking above
+
+   Reads count the lines asked for by the level above, writes the lines
+   it evicts into this one, and write backs the dirty lines this level
+   evicts.  An exclusive level has the line size of the levels above
+   it, and no level has smaller lines than one above */
+
+#define NUM_LEVELS       3   /* L1I, L2 and L3 in -H */
+#define MAX_LOWER_LEVELS 2
+#define NUM_INCLUSIONS   3
+#define INCLUSIVE        0
+#define EXCLUSIVE        1
+
+const char *level_names[NUM_LEVELS] = { "l1i", "l2", "l3" };
+const char *inclusion_names[NUM_INCLUSIONS] = { "inclusive", "exclusive", "nine" };
+
+struct hierarchy {
+  struct cache icache,                     /* L1I                       */
+               *data,                      /* L1D, the machine's cache  */
+               lower[MAX_LOWER_LEVELS];    /* L2 and L3                 */
+  int num_lower,
+      inclusion[MAX_LOWER_LEVELS];
+  unsigned int back_invalidations[MAX_LOWER_LEVELS];
+};
+
+/* levels[0] is L1I and levels[1] and [2] L2 and L3, each sets, ways,
+   line size and inclusion, with sets 0 for a level that is left out;
+   L1I takes the default geometry then */
+void hierarchy_create( struct machine *m, int levels[NUM_LEVELS][4] ){
+  struct hierarchy *h = calloc( 1, sizeof( struct hierarchy ) );
+  if( !h ) out_of_memory();
+  if( levels[0][0] ){
+    cache_configure( &h->icache, levels[0][0], levels[0][1], levels[0][2] );
   }else{
-    misses++;
+    cache_configure( &h->icache, CACHE_SETS, CACHE_WAYS, CACHE_LINE );
+  }
+  for( int k = 0; ( k < MAX_LOWER_LEVELS ) && levels[ k + 1 ][0]; k++ ){
+    int *l = levels[ k + 1 ];
+    cache_configure( &h->lower[ k ], l[0], l[1], l[2] );
+    h->inclusion[ k ] = l[3];
+    h->num_lower++;
+  }
+  h->data = &m->cache;
+  h->icache.hier = h->data->hier = h;
+  m->hier = h;
+}
 
-         if( !valid[0][addr_index] ) bank = 0;
-    else if( !valid[1][addr_index] ) bank = 1;
-    else if( !valid[2][addr_index] ) bank = 2;
-    else if( !valid[3][addr_index] ) bank = 3;
-    else bank = plru_bank[ plru_state[addr_index] ];
+void hierarchy_free( struct machine *m ){
+  struct hierarchy *h = m->hier;
+  if( !h ) return;
+  cache_free( &h->icache );
+  for( int k = 0; k < MAX_LOWER_LEVELS; k++ ) cache_free( &h->lower[ k ] );
+  m->cache.hier = NULL;
+  free( h );
+  m->hier = NULL;
+}
+
+/* byte address of the start of a valid line */
+unsigned int line_address( struct cache *c, unsigned int line ){
+  return ( ( *line_entry( c, line ) >> 1 ) << c->tag_shift ) | ( ( line / c->ways ) << c->offset_bits );
+}
+
+void cache_touch( struct cache *c, unsigned int line, int fill ){
+  policy_touch( c, line / c->ways, line % c->ways, fill );
+}
+
+int level_read( struct hierarchy *h, int k, unsigned int address );
+void level_write( struct hierarchy *h, int k, unsigned int address, int dirty );
+
+/* invalidate the copies of the size bytes at address in the levels
+   above level k, returning whether any was dirty */
+int back_invalidate( struct hierarchy *h, int k, unsigned int address, unsigned int size ){
+  struct cache *above[NUM_LEVELS] = { &h->icache, h->data, &h->lower[0] };
+  int dirty = 0;
+
+  for( int i = 0; i < k + 2; i++ ){
+    struct cache *u = above[ i ];
+    for( unsigned int a = address; a - address < size; a += u->line_size ){
+      int line = cache_find( u, a );
+      if( line < 0 ) continue;
+      dirty |= line_dirty( u, line );
+      line_invalidate( u, line );
+      h->back_invalidations[ k ]++;
+    }
+  }
+  return dirty;
+}
+
+/* empty line of level k, passing it to the level below */
+void level_evict( struct hierarchy *h, int k, unsigned int line ){
+  struct cache *c = &h->lower[ k ];
+  unsigned int address = line_address( c, line );
+  int dirty = line_dirty( c, line );
+
+  if( !line_valid( c, line ) ) return;
+  line_invalidate( c, line );
+  if( h->inclusion[ k ] == INCLUSIVE ) dirty |= back_invalidate( h, k, address, c->line_size );
+  c->write_backs += dirty;
+  level_write( h, k + 1, address, dirty );
+}
+
+/* a clean line of level k for address: the set's first empty way, or
+   its PLRU way evicted */
+unsigned int level_allocate( struct hierarchy *h, int k, unsigned int address ){
+  struct cache *c = &h->lower[ k ];
+  unsigned int set = cache_set( c, address ), line;
+  uint64_t *block = cache_block( c, set ), empty = match_ways( block_entries( block ), 0, c->ways );
+
+  if( empty ){
+    line = set * c->ways + __builtin_ctzll( empty );
+  }else{
+    line = set * c->ways + policy_victim( c, set );
+    level_evict( h, k, line );
+  }
+  *line_entry( c, line ) = cache_entry( c, address );
+  return line;
+}
 
-    if( valid[bank][addr_index] && dirty[bank][addr_index] ){
-      write_backs++;
+/* the level above asks level k for the line holding address; returns
+   whether the line it gets is dirty */
+int level_read( struct hierarchy *h, int k, unsigned int address ){
+  struct cache *c = &h->lower[ k ];
+  int line, dirty;
+
+  if( k == h->num_lower ) return 0;
+  c->cache_reads++;
+  line = cache_find( c, address );
+  if( line >= 0 ){
+    c->hits++;
+    if( h->inclusion[ k ] == EXCLUSIVE ){
+      dirty = line_dirty( c, line );
+      line_invalidate( c, line );
+      return dirty;
     }
+    cache_touch( c, line, 0 );
+    return 0;
+  }
+
+  c->misses++;
+  dirty = level_read( h, k + 1, address );
+  if( h->inclusion[ k ] == EXCLUSIVE ) return dirty;
+  line = level_allocate( h, k, address );
+  line_set_dirty( c, line, dirty );
+  cache_touch( c, line, 1 );
+  return 0;
+}
 
-    valid[bank][addr_index] = 1;
-    dirty[bank][addr_index] = 0;
-    tag[bank][addr_index] = addr_tag;
+/* the level above evicts the line at address into level k: every line
+   for an exclusive level, only dirty ones otherwise */
+void level_write( struct hierarchy *h, int k, unsigned int address, int dirty ){
+  struct cache *c = &h->lower[ k ];
+  int line, fill;
+
+  if( ( k == h->num_lower ) || ( !dirty && ( h->inclusion[ k ] != EXCLUSIVE ) ) ) return;
+  c->cache_writes++;
+  line = cache_find( c, address );
+  fill = ( line < 0 );
+  if( !fill ){
+    c->hits++;
+  }else{
+    c->misses++;
+    line = level_allocate( h, k, address );
   }
+  if( dirty ) line_set_dirty( c, line, 1 );
+  cache_touch( c, line, fill );
+}
 
-  /* update replacement state for this set (i.e., index value) */
+/* an L1 miss on address is to fill line: the line is fetched first,
+   then the one it replaces goes down, so that an exclusive level
+   cannot evict the line being fetched to make room for it.  Returns
+   whether the line arrives dirty */
+int hierarchy_fill( struct cache *c, unsigned int line, unsigned int address ){
+  int victim = line_valid( c, line ), dirty = line_dirty( c, line ), fill;
+  unsigned int victim_address = victim ? line_address( c, line ) : 0;
+
+  line_invalidate( c, line );
+  fill = level_read( c->hier, 0, address );
+  if( victim ) level_write( c->hier, 0, victim_address, dirty );
+  return fill;
+}
 
-  plru_state[addr_index] = next_state[ (plru_state[addr_index]<<2) | bank ];
+void print_hierarchy( struct machine *m ){
+  struct hierarchy *h = m->hier;
+  char name[64];
 
-  /* update dirty bit on a write */
+  level_stats( &h->icache, "L1I cache", m->out );
+  for( int k = 0; k < h->num_lower; k++ ){
+    snprintf( name, sizeof( name ), "L%d cache (%s)", k + 2, inclusion_names[ h->inclusion[ k ] ] );
+    level_stats( &h->lower[ k ], name, m->out );
+    if( h->inclusion[ k ] == INCLUSIVE ){
+      fprintf( m->out, "  back invalidations = %u\n", h->back_invalidations[ k ] );
+    }
+  }
+}
+
+
+
+// opcodes without a handler are ignored, as the switch in main() did
+void ignore_op( struct machine *m ){
+  (void)m;
+}
+
+void (*op_table[64])( struct machine *m ) = {
+  [0x00] = halt,
+  [0x04] = imm_ld,   [0x05] = imm_ldi,  [0x07] = imm_st,
+  [0x14] = btne,     [0x15] = btnei,    [0x16] = bte,      [0x17] = btei,
+  [0x1a] = br,       [0x1c] = bc,       [0x1e] = bnc,
+  [0x24] = adds,     [0x25] = imm_adds, [0x26] = subs,     [0x27] = imm_subs,
+  [0x28] = shl,      [0x29] = shli,     [0x2a] = shr,      [0x2b] = shri,
+  [0x2e] = shra,     [0x2f] = shrai
+};
+
+/* immediate operand or branch displacement (in words) as the handler
+   for op1 uses it when not tracing */
+int decode_imm( int ir, int op1, int genset ){
+  switch( op1 ){
+    case 0x05: return (short)( genset & 0xfffe );
+    case 0x07: return ( ir & 1 ) ? ( ir & 0xe ) : ( ir & 0xf ); /* st.l clears bit 0 */
+    case 0x25:
+    case 0x27: return (short)genset;
+    case 0x14:
+    case 0x15:
+    case 0x16:
+    case 0x17: return (short)( ( ( ( ir >> 16 ) & 0x1f ) << 11 ) | ( ir & 0x7ff ) );
+    case 0x1a:
+    case 0x1c:
+    case 0x1e: return ( ir << 6 ) >> 6;
+  }
+  return genset;
+}
 
-  if( type == 1 ) dirty[bank][addr_index] = 1;
+void predecode( struct machine *m, unsigned int addr ){
+  struct decoded *di = decoded_at( m, addr ) + m->core * PAGE_WORDS;
+
+  m->ir = *mem_word( m, addr );
+  decode( m );
+  di->handler = op_table[ m->op1 ] ? op_table[ m->op1 ] : ignore_op;
+  di->ir      = m->ir;
+  di->op1     = m->op1;
+  di->d       = m->d;
+  di->s1      = m->s1;
+  di->s2      = m->s2;
+  di->genset  = m->genset;
+  di->imm     = decode_imm( m->ir, m->op1, m->genset );
+  di->target  = NULL;     /* filled in by the threaded engine */
+  di->valid   = 1;
+
+  /* the word before may have been fused with the old contents of this one */
+  if( addr & ( ( PAGE_WORDS - 1 ) << 2 ) ) di[ -1 ].target = NULL;
 }
 
+/* execute the instruction at fip, decoded in di, through its handler */
+static inline void execute( struct machine *m, struct decoded *di ){
+  m->xip = m->fip;
+  m->fip = m->xip + 4;
+  m->inst_fetches++;
+
+  m->ir     = di->ir;
+  m->op1    = di->op1;
+  m->d      = di->d;
+  m->s1     = di->s1;
+  m->s2     = di->s2;
+  m->genset = di->genset;
+  di->handler( m );
+  m->reg[ 0 ] = 0;
+}
 
+/* execute the instruction at fip through its handler */
+void step( struct machine *m ){
+  struct decoded *di = decoded_at( m, m->fip );
+  if( !di->valid ) predecode( m, m->fip );
+  execute( m, di );
+}
 
-int main( int argc, char **argv ){
-  
-cache_init();
+void print_regs( struct machine *m ){
+  for( int i = 0; i < 8 ; i++ ){
+    fprintf( m->out, "  r%x: %08x", i , m->reg[ i ] );
+    fprintf( m->out, "  r%x: %08x", i + 8 , m->reg[ i + 8 ] );
+    fprintf( m->out, "  r%x: %08x", i + 16, m->reg[ i + 16 ] );
+    fprintf( m->out, "  r%x: %08x\n", i + 24, m->reg[ i + 24 ] );
+  }
+  fprintf(m->out, "  cc: %x\n", m->cc_bit);
+}
 
-if( argc > 1 ){
-    if( ( argv[1][0] == '-' ) && ( argv[1][1] == 't' ) ){
-      verbose = 1;
-    }else if( ( argv[1][0] == '-' ) && ( argv[1][1] == 'v' ) ){
-      verbose = 2;
-    }else{
-      printf( "usage:\n");
-      printf( "  %s for just execution statistics\n", argv[0] );
-      printf( "  %s -t for instruction trace\n", argv[0] );
-      printf( "  %s -v for instructions, registers, and memory\n", argv[0] );
-      printf( "input is read as hex 32-bit values from stdin\n" );
-      exit( -1 );
+/* reference engine: call the pre-decoded handler for each instruction.
+   It is written once and instantiated for each trace level and cache
+   model, with both as constants, so the statistics-only loop carries no
+   trace or cache tests; run_basic() picks the instantiation when it
+   starts.  A traced loop calls the handlers, which print the instruction
+   text; a quiet one runs the handlers' bodies in line, down to their
+   checks for a zero branch displacement */
+
+static inline __attribute__(( always_inline ))
+void interpret( struct machine *m, const int trace, const int cache ){
+  struct page *page;
+  int addr;
+
+  if( trace ) fprintf( m->out, "instruction trace:\n" );
+  while( !m->halt_flag ){
+
+    if( trace ) fprintf( m->out, "at %02x, ", m->fip );
+    struct decoded *di = decoded_at( m, m->fip );
+    if( !di->valid ) predecode( m, m->fip );
+    m->xip = m->fip;
+    m->fip = m->xip + 4;
+    m->inst_fetches++;
+
+    if( trace ){
+      m->ir     = di->ir;
+      m->op1    = di->op1;
+      m->d      = di->d;
+      m->s1     = di->s1;
+      m->s2     = di->s2;
+      m->genset = di->genset;
+      di->handler( m );
+      m->reg[ 0 ] = 0;
+      if( ( trace > 1 ) || ( m->halt_flag && ( trace == 1 ) ) ) print_regs( m );
+      continue;
+    }
+
+    switch( di->op1 ){
+      case 0x00:
+        m->halt_flag = 1;
+        break;
+      case 0x04:
+      case 0x05:
+        addr = ( di->op1 == 0x04 ) ? ( ( ( m->reg[ di->s1 ] + m->reg[ di->s2 ] ) << 16 ) >> 16 )
+                                   : (short)( di->imm + m->reg[ di->s2 ] );
+        if( cache ) cache_access( &m->cache, addr, 0 );
+        m->reg[ di->d ] = *mem_word( m, addr );
+        m->memory_reads++;
+        break;
+      case 0x07:
+        addr = (short)( di->imm + m->reg[ di->s2 ] );
+        if( cache ) cache_access( &m->cache, addr, 1 );
+        page = mem_page( m, addr );
+        page->word[ ( addr >> 2 ) & ( PAGE_WORDS - 1 ) ] = m->reg[ di->s1 ];
+        page->dirty = 1;
+        if( page->decoded ) page->decoded[ ( addr >> 2 ) & ( PAGE_WORDS - 1 ) ].valid = 0;
+        if( m->jit ) jit_note_store( m, addr );
+        m->memory_writes++;
+        break;
+
+      case 0x14:
+      case 0x15:
+      case 0x16:
+      case 0x17:
+        if( ( di->op1 != 0x14 ) && !di->imm ){
+          zero_displacement( m );
+          break;
+        }
+        m->branches++;
+        switch( di->op1 ){
+          case 0x14: addr = m->reg[ di->s1 ] != m->reg[ di->s2 ]; break;
+          case 0x15: addr = di->s1 != m->reg[ di->s2 ];            break;
+          case 0x16: addr = m->reg[ di->s1 ] == m->reg[ di->s2 ]; break;
+          default:   addr = di->s1 == m->reg[ di->s2 ];            break;
+        }
+        if( addr ){
+          m->fip += di->imm << 2;
+          m->taken++;
+        }
+        break;
+      case 0x1a:
+        if( !di->imm ){
+          zero_displacement( m );
+          break;
+        }
+        m->fip += di->imm << 2;
+        m->branches++;
+        m->taken++;
+        break;
+      case 0x1c:
+      case 0x1e:
+        if( m->cc_bit == ( di->op1 == 0x1c ) ){
+          if( !di->imm ){
+            zero_displacement( m );
+            break;
+          }
+          m->fip += di->imm << 2;
+          m->taken++;
+        }
+        m->branches++;
+        break;
+
+      case 0x24:
+        addr = m->reg[ di->s2 ];
+        m->reg[ di->d ] = m->reg[ di->s1 ] + addr;
+        m->cc_bit = ( addr < ( ~m->reg[ di->s1 ] + 1 ) ) ? 1 : 0;
+        break;
+      case 0x25:
+        m->reg[ di->d ] = m->reg[ di->s2 ] + di->imm;
+        m->cc_bit = ( m->reg[ di->s2 ] < -di->imm ) ? 1 : 0;
+        break;
+      case 0x26:
+        m->reg[ di->d ] = m->reg[ di->s1 ] - m->reg[ di->s2 ];
+        m->cc_bit = ( m->reg[ di->s2 ] > m->reg[ di->s1 ] ) ? 1 : 0;
+        break;
+      case 0x28:
+        m->reg[ di->d ] = m->reg[ di->s2 ] << m->reg[ di->s1 ];
+        break;
+      case 0x29:
+        m->reg[ di->d ] = m->reg[ di->s2 ] << di->genset;
+        break;
+      case 0x2b:
+      case 0x2f:
+        m->reg[ di->d ] = m->reg[ di->s2 ] >> di->genset;
+        break;
+      case 0x2e:
+        m->reg[ di->d ] = m->reg[ di->s2 ] >> m->reg[ di->s1 ];
+        break;
+
+      /* opcodes that print, or have no handler */
+      default:
+        m->ir     = di->ir;
+        m->op1    = di->op1;
+        m->d      = di->d;
+        m->s1     = di->s1;
+        m->s2     = di->s2;
+        m->genset = di->genset;
+        di->handler( m );
+        break;
     }
+    m->reg[ 0 ] = 0;
+  }
+}
+
+void run_basic_quiet( struct machine *m ){ interpret( m, 0, 1 ); }
+void run_basic_quiet_no_cache( struct machine *m ){ interpret( m, 0, 0 ); }
+void run_basic_trace( struct machine *m ){ interpret( m, 1, 1 ); }
+void run_basic_verbose( struct machine *m ){ interpret( m, 2, 1 ); }
+
+/* by trace level and whether the cache is modelled; a traced run goes
+   through the handlers, whose cache_access() checks the cache's off
+   flag itself */
+void (*basic_engines[3][2])( struct machine *m ) = {
+  { run_basic_quiet_no_cache, run_basic_quiet },
+  { run_basic_trace,          run_basic_trace },
+  { run_basic_verbose,        run_basic_verbose }
+};
+
+void run_basic( struct machine *m ){
+  basic_engines[ m->verbose ][ !m->cache.off ]( m );
+}
+
+/* binary execution trace.  The file starts with a trace header and the
+   program as a binary image, followed by one record per instruction:
+
+     pc, instruction word            32 bits each
+     flags                           8 bits: cc, read, write
+     number of changed registers     8 bits
+     address                         32 bits, if read or write
+     stored value                    32 bits, if write
+     register, new value             8 and 32 bits, per changed register
+
+   Records are packed into one of two large buffers; when it fills, a
+   writer thread drains it to the file while the simulation carries on
+   in the other.  simtrace.c renders a trace as the -t or -v text */
+
+#define TRACE_MAGIC   0x74363869  /* "i86t" */
+#define TRACE_VERSION 1
+#define TRACE_BUFFER  ( 4 * 1024 * 1024 )
+#define TRACE_MAX_RECORD ( 18 + 32 * 5 )
+
+#define TRACE_CC    1
+#define TRACE_READ  2
+#define TRACE_WRITE 4
+
+struct trace_header {
+  uint32_t magic, version, from_hex, image_size;
+};
+
+struct tracer {
+  FILE *f;
+  unsigned char *buf[2],
+                *pending;      /* buffer handed to the writer, or NULL */
+  size_t fill,                 /* bytes in buf[ cur ]                  */
+         pending_size;
+  int cur,
+      done;
+  pthread_t writer;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+void *trace_writer( void *arg ){
+  struct tracer *t = arg;
+
+  pthread_mutex_lock( &t->lock );
+  for( ;; ){
+    while( !t->pending && !t->done ) pthread_cond_wait( &t->cond, &t->lock );
+    if( !t->pending ) break;
+    pthread_mutex_unlock( &t->lock );
+    fwrite( t->pending, 1, t->pending_size, t->f );
+    pthread_mutex_lock( &t->lock );
+    t->pending = NULL;
+    pthread_cond_broadcast( &t->cond );
+  }
+  pthread_mutex_unlock( &t->lock );
+  return NULL;
+}
+
+/* hand the filled buffer to the writer and switch to the other one */
+void trace_flush( struct tracer *t ){
+  pthread_mutex_lock( &t->lock );
+  while( t->pending ) pthread_cond_wait( &t->cond, &t->lock );
+  t->pending = t->buf[ t->cur ];
+  t->pending_size = t->fill;
+  pthread_cond_broadcast( &t->cond );
+  pthread_mutex_unlock( &t->lock );
+  t->cur ^= 1;
+  t->fill = 0;
+}
+
+size_t image_size( struct image *img ){
+  size_t size = sizeof( struct image_header ) + img->num_segments * sizeof( struct image_segment );
+  for( int i = 0; i < img->num_segments; i++ ) size += img->segments[ i ].words * sizeof( int );
+  return size;
+}
+
+struct tracer *trace_open( struct machine *m, const char *name ){
+  struct tracer *t = calloc( 1, sizeof( *t ) );
+  if( !t ) out_of_memory();
+  t->f = fopen( name, "wb" );
+  if( !t->f ){
+    fprintf( m->out, "cannot write %s\n", name );
+    fail();
   }
+  t->buf[0] = malloc( TRACE_BUFFER );
+  t->buf[1] = malloc( TRACE_BUFFER );
+  if( !t->buf[0] || !t->buf[1] ) out_of_memory();
+
+  struct trace_header h = { TRACE_MAGIC, TRACE_VERSION, m->image.from_hex, image_size( &m->image ) };
+  fwrite( &h, sizeof( h ), 1, t->f );
+  write_image( m, t->f );
+
+  pthread_mutex_init( &t->lock, NULL );
+  pthread_cond_init( &t->cond, NULL );
+  pthread_create( &t->writer, NULL, trace_writer, t );
+  return t;
+}
+
+void trace_close( struct tracer *t ){
+  trace_flush( t );
+  pthread_mutex_lock( &t->lock );
+  t->done = 1;
+  pthread_cond_broadcast( &t->cond );
+  pthread_mutex_unlock( &t->lock );
+  pthread_join( t->writer, NULL );
+  fclose( t->f );
+  free( t->buf[0] );
+  free( t->buf[1] );
+  free( t );
+}
 
-  get_mem();
-
-  if( verbose ) printf( "instruction trace:\n" );
-  while( !halt_flag ){
-
-    if( verbose ) printf( "at %02x, ", fip );
-    ir = mem[ fip >> 2 ];
-    xip = fip;
-    fip = xip + 4;
-    inst_fetches++;
-
-
-    decode();
-
-    switch( op1 ){
-      case 0x00:        halt();     break;
-      case 0x04:        imm_ld();   break;
-      case 0x05:        imm_ldi();  break;
-      case 0x07:        imm_st();   break;
-      
-      case 0x14:        btne();     break;
-      case 0x15:        btnei();    break; 
-      case 0x16:        bte();      break;
-      case 0x17:        btei();     break;
-      
-      case 0x1a:        br();       break;
-      case 0x1c:        bc();       break;
-      case 0x1e:        bnc();      break;
-
-      case 0x24:        adds();     break;
-      case 0x25:        imm_adds(); break;
-      case 0x26:        subs();     break;
-      case 0x27:        imm_subs(); break;
-      case 0x28:        shl();      break;
-      case 0x29:        shli();     break;
-      
-      case 0x2a:        shr();      break;
-      case 0x2b:        shri();     break;
-      case 0x2e:        shra();     break;
-      case 0x2f:        shrai();    break;
-    }
-
-    reg[ 0 ] = 0; 
-
-    if( ( verbose > 1 ) || ( halt_flag && ( verbose == 1 )) ){
-      for( int i = 0; i < 8 ; i++ ){
-        printf( "  r%x: %08x", i , reg[ i ] );
-        printf( "  r%x: %08x", i + 8 , reg[ i + 8 ] );
-        printf( "  r%x: %08x", i + 16, reg[ i + 16 ] );
-        printf( "  r%x: %08x\n", i + 24, reg[ i + 24 ] );
+static inline unsigned char *trace_put( unsigned char *p, uint32_t v ){
+  memcpy( p, &v, 4 );
+  return p + 4;
+}
+
+/* the basic engine without text output, writing a trace record for
+   each instruction */
+void run_traced( struct machine *m, struct tracer *t ){
+  int before[32], reads, writes;
+
+  while( !m->halt_flag ){
+    struct decoded *di = decoded_at( m, m->fip );
+    if( !di->valid ) predecode( m, m->fip );
+    m->xip = m->fip;
+    m->fip = m->xip + 4;
+    m->inst_fetches++;
+
+    m->ir     = di->ir;
+    m->op1    = di->op1;
+    m->d      = di->d;
+    m->s1     = di->s1;
+    m->s2     = di->s2;
+    m->genset = di->genset;
+    memcpy( before, m->reg, sizeof( before ) );
+    reads  = m->memory_reads;
+    writes = m->memory_writes;
+    di->handler( m );
+    m->reg[ 0 ] = 0;
+
+    if( t->fill > TRACE_BUFFER - TRACE_MAX_RECORD ) trace_flush( t );
+    unsigned char *p = t->buf[ t->cur ] + t->fill, *flags;
+    p = trace_put( p, m->xip );
+    p = trace_put( p, m->ir );
+    flags = p;
+    p[0] = m->cc_bit ? TRACE_CC : 0;
+    p[1] = 0;
+    p += 2;
+    if( m->memory_reads != reads ){
+      flags[0] |= TRACE_READ;
+      p = trace_put( p, m->eff_addr );
+    }else if( m->memory_writes != writes ){
+      flags[0] |= TRACE_WRITE;
+      p = trace_put( p, m->eff_addr );
+      p = trace_put( p, m->reg[ m->s1 ] );
+    }
+    for( int i = 1; i < 32; i++ ){
+      if( m->reg[ i ] != before[ i ] ){
+        *p++ = i;
+        p = trace_put( p, m->reg[ i ] );
+        flags[1]++;
       }
-      printf("  cc: %x\n", cc_bit);
     }
+    t->fill = p - t->buf[ t->cur ];
   }
+}
 
-  if( verbose ) printf( "\n" );
-  printf( "execution statistics (in decimal):\n" );
-  printf( "  instruction fetches = %d\n", inst_fetches );
-  printf( "  data words read     = %d\n", memory_reads );
-  printf( "  data words written  = %d\n", memory_writes );
-  printf( "  branches executed   = %d\n", branches );
-  if( taken == 0 ){
-    printf( "  branches taken      = 0\n" );
-  }else{
-    printf( "  branches taken      = %d (%.1f%%)\n",
-      taken, 100.0*((float)taken)/((float)branches) );
+/* per-address profile.  Each page that code runs from gets counters for
+   executions, taken branches and memory accesses of its words.  A taken
+   branch to a lower or equal address is a loop back edge; the loop it
+   closes is found by its branch address in a hash table.  Each run of
+   the branch, taken or not, ends one pass through the loop body, and
+   each time it falls through, or the run ends, the passes since the loop
+   was entered go into a histogram of powers of two as the trip count */
+
+#define PROFILE_TOP  20         /* addresses in the text report */
+#define LOOP_BUCKETS 16         /* trip counts 1, 2-3, 4-7, ..., 32768+ */
+
+struct profile_page {
+  uint64_t exec[PAGE_WORDS],
+           taken[PAGE_WORDS],
+           mem[PAGE_WORDS];
+};
+
+struct loop {
+  unsigned int pc,              /* address of the back edge, ~0 when empty */
+               target;
+  uint64_t entries,
+           iterations,          /* passes through the body                 */
+           trip,                /* passes of the current entry             */
+           hist[LOOP_BUCKETS];
+};
+
+struct profile {
+  struct loop *loops;
+  int num_loops,
+      size;                     /* slots, a power of two */
+};
+
+struct profile_page *profile_page_at( struct machine *m, unsigned int addr ){
+  struct page *p = mem_page( m, addr );
+  if( !p->prof ){
+    p->prof = calloc( 1, sizeof( struct profile_page ) );
+    if( !p->prof ) out_of_memory();
   }
-  cache_stats();
-  return 0;
-}
\ No newline at end of file
+  return p->prof;
+}
+
+struct loop *loop_at( struct profile *prof, unsigned int pc, int create ){
+  if( create && ( 2 * ( prof->num_loops + 1 ) > prof->size ) ){
+    struct loop *old = prof->loops;
+    int old_size = prof->size;
+    prof->size = old_size ? 2 * old_size : 64;
+    prof->loops = calloc( prof->size, sizeof( struct loop ) );
+    if( !prof->loops ) out_of_memory();
+    for( int i = 0; i < prof->size; i++ ) prof->loops[ i ].pc = ~0u;
+    prof->num_loops = 0;
+    for( int i = 0; i < old_size; i++ ){
+      if( old[ i ].pc != ~0u ) *loop_at( prof, old[ i ].pc, 1 ) = old[ i ];
+    }
+    free( old );
+  }
+  if( !prof->size ) return NULL;
+
+  for( unsigned int i = ( pc >> 2 ) * 2654435761u; ; i++ ){
+    struct loop *l = &prof->loops[ i & ( prof->size - 1 ) ];
+    if( l->pc == pc ) return l;
+    if( l->pc == ~0u ){
+      if( !create ) return NULL;
+      l->pc = pc;
+      prof->num_loops++;
+      return l;
+    }
+  }
+}
+
+void loop_exit( struct loop *l ){
+  int b = 0;
+  if( !l->trip ) return;
+  while( ( b < LOOP_BUCKETS - 1 ) && ( ( l->trip >> ( b + 1 ) ) != 0 ) ) b++;
+  l->hist[ b ]++;
+  l->trip = 0;
+}
+
+void profile_note( struct machine *m, unsigned int pc, int memory, int branched, int taken ){
+  struct profile_page *pp = profile_page_at( m, pc );
+  int w = ( pc >> 2 ) & ( PAGE_WORDS - 1 );
+
+  struct loop *l = NULL;
+
+  pp->exec[ w ]++;
+  pp->mem[ w ] += memory;
+  if( !branched ) return;
+
+  if( !taken ){
+    l = loop_at( m->prof, pc, 0 );
+  }else{
+    pp->taken[ w ]++;
+    if( (unsigned)m->fip <= pc ){
+      l = loop_at( m->prof, pc, 1 );
+      l->target = m->fip;
+    }
+  }
+  if( !l ) return;
+  if( !l->trip ) l->entries++;
+  l->trip++;
+  l->iterations++;
+  if( !taken ) loop_exit( l );
+}
+
+/* close the loops still open when the run ends */
+void profile_end( struct machine *m ){
+  for( int i = 0; i < m->prof->size; i++ ){
+    if( m->prof->loops[ i ].pc != ~0u ) loop_exit( &m->prof->loops[ i ] );
+  }
+}
+
+void profile_create( struct machine *m ){
+  m->prof = calloc( 1, sizeof( struct profile ) );
+  if( !m->prof ) out_of_memory();
+}
+
+void profile_free( struct machine *m ){
+  if( m->prof ) free( m->prof->loops );
+  free( m->prof );
+  m->prof = NULL;
+}
+
+struct profile_entry {
+  unsigned int pc;
+  uint64_t exec, taken, mem;
+};
+
+int by_exec( const void *a, const void *b ){
+  const struct profile_entry *x = a, *y = b;
+  if( x->exec != y->exec ) return ( x->exec < y->exec ) ? 1 : -1;
+  return ( x->pc > y->pc ) - ( x->pc < y->pc );
+}
+
+int by_iterations( const void *a, const void *b ){
+  const struct loop *x = a, *y = b;
+  if( x->iterations != y->iterations ) return ( x->iterations < y->iterations ) ? 1 : -1;
+  return ( x->pc > y->pc ) - ( x->pc < y->pc );
+}
+
+/* addresses and loops from hottest down, as text or as CSV */
+void print_profile( struct machine *m, int csv ){
+  struct profile_entry *e = NULL;
+  int n = 0, cap = 0, num_loops = 0;
+  uint64_t total = 0;
+
+  for( struct page *p = m->pages; p; p = p->next ){
+    if( !p->prof ) continue;
+    for( int i = 0; i < PAGE_WORDS; i++ ){
+      if( !p->prof->exec[ i ] ) continue;
+      if( n == cap ) e = realloc( e, ( cap = cap ? 2 * cap : 256 ) * sizeof( *e ) );
+      e[ n ].pc    = ( p->vpn << PAGE_SHIFT ) + 4 * i;
+      e[ n ].exec  = p->prof->exec[ i ];
+      e[ n ].taken = p->prof->taken[ i ];
+      e[ n ].mem   = p->prof->mem[ i ];
+      total += e[ n++ ].exec;
+    }
+  }
+  qsort( e, n, sizeof( *e ), by_exec );
+
+  struct loop *loops = malloc( ( m->prof ? m->prof->num_loops : 0 ) * sizeof( struct loop ) + 1 );
+  for( int i = 0; m->prof && ( i < m->prof->size ); i++ ){
+    if( m->prof->loops[ i ].pc != ~0u ) loops[ num_loops++ ] = m->prof->loops[ i ];
+  }
+  qsort( loops, num_loops, sizeof( *loops ), by_iterations );
+
+  if( csv ){
+    fprintf( m->out, "address,instruction,count,taken,memory\n" );
+    for( int i = 0; i < n; i++ ){
+      fprintf( m->out, "%x,%08x,%llu,%llu,%llu\n", e[ i ].pc, *mem_word( m, e[ i ].pc ),
+        (unsigned long long)e[ i ].exec, (unsigned long long)e[ i ].taken, (unsigned long long)e[ i ].mem );
+    }
+    fprintf( m->out, "\nbranch,target,entries,iterations" );
+    for( int b = 0; b < LOOP_BUCKETS - 1; b++ ) fprintf( m->out, ",trips_%u", 1u << b );
+    fprintf( m->out, ",trips_%u+\n", 1u << ( LOOP_BUCKETS - 1 ) );
+    for( int i = 0; i < num_loops; i++ ){
+      fprintf( m->out, "%x,%x,%llu,%llu", loops[ i ].pc, loops[ i ].target,
+        (unsigned long long)loops[ i ].entries, (unsigned long long)loops[ i ].iterations );
+      for( int b = 0; b < LOOP_BUCKETS; b++ ) fprintf( m->out, ",%llu", (unsigned long long)loops[ i ].hist[ b ] );
+      fprintf( m->out, "\n" );
+    }
+  }else{
+    fprintf( m->out, "profile (in decimal), %d addresses executed:\n", n );
+    fprintf( m->out, "  address  instruction       count      %%       taken      memory\n" );
+    for( int i = 0; ( i < n ) && ( i < PROFILE_TOP ); i++ ){
+      fprintf( m->out, "  %7x  %08x  %12llu  %5.1f  %10llu  %10llu\n", e[ i ].pc, *mem_word( m, e[ i ].pc ),
+        (unsigned long long)e[ i ].exec, 100.0 * e[ i ].exec / total,
+        (unsigned long long)e[ i ].taken, (unsigned long long)e[ i ].mem );
+    }
+    fprintf( m->out, "hot loops (in decimal), %d back edges:\n", num_loops );
+    for( int i = 0; ( i < num_loops ) && ( i < PROFILE_TOP ); i++ ){
+      fprintf( m->out, "  %x -> %x  entries = %llu  iterations = %llu  average trip = %.1f\n",
+        loops[ i ].pc, loops[ i ].target, (unsigned long long)loops[ i ].entries,
+        (unsigned long long)loops[ i ].iterations, (double)loops[ i ].iterations / loops[ i ].entries );
+      fprintf( m->out, "    trips:" );
+      for( int b = 0; b < LOOP_BUCKETS - 1; b++ ){
+        if( loops[ i ].hist[ b ] ) fprintf( m->out, "  %u-%u: %llu", 1u << b, ( 2u << b ) - 1,
+                                            (unsigned long long)loops[ i ].hist[ b ] );
+      }
+      if( loops[ i ].hist[ LOOP_BUCKETS - 1 ] ) fprintf( m->out, "  %u+: %llu", 1u << ( LOOP_BUCKETS - 1 ),
+                                                         (unsigned long long)loops[ i ].hist[ LOOP_BUCKETS - 1 ] );
+      fprintf( m->out, "\n" );
+    }
+  }
+  free( e );
+  free( loops );
+}
+
+/* branch prediction.  Every model in predictor_models[] watches every
+   branch of an instrumented run, so they are compared on the same
+   stream.  A model predicts the address that follows a branch, given
+   the branch target that decode would supply, and is then told the
+   outcome.  Mispredictions are also counted per branch address */
+
+#define NUM_PREDICTORS 5
+#define BP_ENTRIES     4096     /* two-bit counters in a pattern table */
+#define BP_HISTORY     12       /* global history bits used by gshare  */
+#define BTB_ENTRIES    512
+
+struct predictor_model {
+  const char *name;
+  size_t size;                  /* bytes of state, zero at the start */
+  unsigned int (*predict)( void *s, unsigned int pc, unsigned int target );
+  void (*update)( void *s, unsigned int pc, unsigned int target, int taken );
+};
+
+struct bimodal {
+  unsigned char ctr[BP_ENTRIES];
+};
+
+struct gshare {
+  unsigned char ctr[BP_ENTRIES];
+  unsigned int history;
+};
+
+struct tournament {
+  struct bimodal local;
+  struct gshare global;
+  unsigned char choice[BP_ENTRIES];  /* two-bit, high favours gshare */
+};
+
+struct btb {
+  unsigned int valid[BTB_ENTRIES],
+               tag[BTB_ENTRIES],
+               target[BTB_ENTRIES];
+};
+
+static inline void counter_update( unsigned char *c, int up ){
+  if( up && ( *c < 3 ) ) ( *c )++;
+  if( !up && ( *c > 0 ) ) ( *c )--;
+}
+
+/* backward taken, forward not taken */
+unsigned int static_predict( void *s, unsigned int pc, unsigned int target ){
+  (void)s;
+  return ( target <= pc ) ? target : pc + 4;
+}
+
+void static_update( void *s, unsigned int pc, unsigned int target, int taken ){
+  (void)s; (void)pc; (void)target; (void)taken;
+}
+
+unsigned int bimodal_predict( void *s, unsigned int pc, unsigned int target ){
+  struct bimodal *b = s;
+  return ( b->ctr[ ( pc >> 2 ) & ( BP_ENTRIES - 1 ) ] >= 2 ) ? target : pc + 4;
+}
+
+void bimodal_update( void *s, unsigned int pc, unsigned int target, int taken ){
+  struct bimodal *b = s;
+  (void)target;
+  counter_update( &b->ctr[ ( pc >> 2 ) & ( BP_ENTRIES - 1 ) ], taken );
+}
+
+static inline int gshare_index( struct gshare *g, unsigned int pc ){
+  return ( ( pc >> 2 ) ^ g->history ) & ( BP_ENTRIES - 1 );
+}
+
+unsigned int gshare_predict( void *s, unsigned int pc, unsigned int target ){
+  struct gshare *g = s;
+  return ( g->ctr[ gshare_index( g, pc ) ] >= 2 ) ? target : pc + 4;
+}
+
+void gshare_update( void *s, unsigned int pc, unsigned int target, int taken ){
+  struct gshare *g = s;
+  (void)target;
+  counter_update( &g->ctr[ gshare_index( g, pc ) ], taken );
+  g->history = ( ( g->history << 1 ) | ( taken != 0 ) ) & ( ( 1 << BP_HISTORY ) - 1 );
+}
+
+unsigned int tournament_predict( void *s, unsigned int pc, unsigned int target ){
+  struct tournament *t = s;
+  if( t->choice[ ( pc >> 2 ) & ( BP_ENTRIES - 1 ) ] >= 2 ) return gshare_predict( &t->global, pc, target );
+  return bimodal_predict( &t->local, pc, target );
+}
+
+void tournament_update( void *s, unsigned int pc, unsigned int target, int taken ){
+  struct tournament *t = s;
+  unsigned int next = taken ? target : pc + 4;
+  int local_right  = bimodal_predict( &t->local, pc, target ) == next,
+      global_right = gshare_predict( &t->global, pc, target ) == next;
+
+  if( local_right != global_right ){
+    counter_update( &t->choice[ ( pc >> 2 ) & ( BP_ENTRIES - 1 ) ], global_right );
+  }
+  bimodal_update( &t->local, pc, target, taken );
+  gshare_update( &t->global, pc, target, taken );
+}
+
+/* a hit predicts taken to the remembered target, a miss falls through;
+   entries are made by taken branches and dropped when not taken */
+unsigned int btb_predict( void *s, unsigned int pc, unsigned int target ){
+  struct btb *b = s;
+  int i = ( pc >> 2 ) & ( BTB_ENTRIES - 1 );
+  (void)target;
+  return ( b->valid[ i ] && ( b->tag[ i ] == pc ) ) ? b->target[ i ] : pc + 4;
+}
+
+void btb_update( void *s, unsigned int pc, unsigned int target, int taken ){
+  struct btb *b = s;
+  int i = ( pc >> 2 ) & ( BTB_ENTRIES - 1 );
+  if( taken ){
+    b->valid[ i ]  = 1;
+    b->tag[ i ]    = pc;
+    b->target[ i ] = target;
+  }else if( b->tag[ i ] == pc ){
+    b->valid[ i ] = 0;
+  }
+}
+
+const struct predictor_model predictor_models[NUM_PREDICTORS] = {
+  { "static",     0,                         static_predict,     static_update },
+  { "bimodal",    sizeof( struct bimodal ),    bimodal_predict,    bimodal_update },
+  { "gshare",     sizeof( struct gshare ),     gshare_predict,     gshare_update },
+  { "tournament", sizeof( struct tournament ), tournament_predict, tournament_update },
+  { "btb",        sizeof( struct btb ),        btb_predict,        btb_update }
+};
+
+struct branch_record {
+  unsigned int pc;              /* ~0 when empty */
+  uint64_t executed,
+           taken,
+           misses[NUM_PREDICTORS];
+};
+
+struct predictors {
+  void *state[NUM_PREDICTORS];
+  uint64_t branches,
+           misses[NUM_PREDICTORS];
+  struct branch_record *records;
+  int num_records,
+      size;                     /* slots, a power of two */
+};
+
+void predictors_create( struct machine *m ){
+  struct predictors *bp = m->bp = calloc( 1, sizeof( *bp ) );
+  if( !bp ) out_of_memory();
+  for( int i = 0; i < NUM_PREDICTORS; i++ ){
+    bp->state[ i ] = calloc( 1, predictor_models[ i ].size + 1 );
+    if( !bp->state[ i ] ) out_of_memory();
+  }
+}
+
+void predictors_free( struct machine *m ){
+  if( !m->bp ) return;
+  for( int i = 0; i < NUM_PREDICTORS; i++ ) free( m->bp->state[ i ] );
+  free( m->bp->records );
+  free( m->bp );
+  m->bp = NULL;
+}
+
+struct branch_record *branch_record_at( struct predictors *bp, unsigned int pc ){
+  if( 2 * ( bp->num_records + 1 ) > bp->size ){
+    struct branch_record *old = bp->records;
+    int old_size = bp->size;
+    bp->size = old_size ? 2 * old_size : 64;
+    bp->records = calloc( bp->size, sizeof( struct branch_record ) );
+    if( !bp->records ) out_of_memory();
+    for( int i = 0; i < bp->size; i++ ) bp->records[ i ].pc = ~0u;
+    bp->num_records = 0;
+    for( int i = 0; i < old_size; i++ ){
+      if( old[ i ].pc != ~0u ) *branch_record_at( bp, old[ i ].pc ) = old[ i ];
+    }
+    free( old );
+  }
+
+  for( unsigned int i = ( pc >> 2 ) * 2654435761u; ; i++ ){
+    struct branch_record *r = &bp->records[ i & ( bp->size - 1 ) ];
+    if( r->pc == pc ) return r;
+    if( r->pc == ~0u ){
+      r->pc = pc;
+      bp->num_records++;
+      return r;
+    }
+  }
+}
+
+/* the branch at pc has run, and fip is where it went */
+void predict_note( struct machine *m, unsigned int pc, int taken ){
+  struct predictors *bp = m->bp;
+  struct branch_record *r = branch_record_at( bp, pc );
+  unsigned int target = pc + 4 + ( decoded_at( m, pc )->imm << 2 );
+
+  bp->branches++;
+  r->executed++;
+  r->taken += taken;
+  for( int i = 0; i < NUM_PREDICTORS; i++ ){
+    const struct predictor_model *model = &predictor_models[ i ];
+    if( model->predict( bp->state[ i ], pc, target ) != (unsigned)m->fip ){
+      bp->misses[ i ]++;
+      r->misses[ i ]++;
+    }
+    model->update( bp->state[ i ], pc, target, taken );
+  }
+}
+
+int by_executed( const void *a, const void *b ){
+  const struct branch_record *x = a, *y = b;
+  if( x->executed != y->executed ) return ( x->executed < y->executed ) ? 1 : -1;
+  return ( x->pc > y->pc ) - ( x->pc < y->pc );
+}
+
+void print_predictors( struct machine *m ){
+  struct predictors *bp = m->bp;
+  struct branch_record *r = malloc( bp->num_records * sizeof( *r ) + 1 );
+  int n = 0;
+
+  fprintf( m->out, "branch prediction (in decimal):\n" );
+  fprintf( m->out, "  predictor   mispredicts  accuracy     MPKI\n" );
+  for( int i = 0; i < NUM_PREDICTORS; i++ ){
+    fprintf( m->out, "  %-10s  %11llu  %7.1f%%  %7.2f\n", predictor_models[ i ].name,
+      (unsigned long long)bp->misses[ i ],
+      bp->branches ? 100.0 * ( bp->branches - bp->misses[ i ] ) / bp->branches : 100.0,
+      m->inst_fetches ? 1000.0 * bp->misses[ i ] / (unsigned)m->inst_fetches : 0.0 );
+  }
+
+  for( int i = 0; i < bp->size; i++ ){
+    if( bp->records[ i ].pc != ~0u ) r[ n++ ] = bp->records[ i ];
+  }
+  qsort( r, n, sizeof( *r ), by_executed );
+  fprintf( m->out, "mispredicts by branch (in decimal), %d branches:\n", n );
+  fprintf( m->out, "  address    executed       taken" );
+  for( int i = 0; i < NUM_PREDICTORS; i++ ) fprintf( m->out, "  %10s", predictor_models[ i ].name );
+  fprintf( m->out, "\n" );
+  for( int i = 0; ( i < n ) && ( i < PROFILE_TOP ); i++ ){
+    fprintf( m->out, "  %7x  %10llu  %10llu", r[ i ].pc,
+      (unsigned long long)r[ i ].executed, (unsigned long long)r[ i ].taken );
+    for( int j = 0; j < NUM_PREDICTORS; j++ ) fprintf( m->out, "  %10llu", (unsigned long long)r[ i ].misses[ j ] );
+    fprintf( m->out, "\n" );
+  }
+  free( r );
+}
+
+/* timing model of the integer pipeline.  Each instruction issues in
+   one cycle, plus stalls for
+
+     load-use     an instruction reading the register the previous ld.l
+                  loaded waits for it
+     branch       a taken branch discards the instructions fetched
+                  behind it; compare-and-branch resolves a stage later
+                  than br, bc and bnc, which need only cc
+     miss         a data cache miss waits for the line from memory
+     write back   a miss that evicts a dirty line first writes it
+
+   The penalties can be set at compile time */
+
+#ifndef LOAD_USE_CYCLES
+#define LOAD_USE_CYCLES   1
+#endif
+#ifndef BRANCH_CYCLES
+#define BRANCH_CYCLES     1
+#endif
+#ifndef COMPARE_BRANCH_CYCLES
+#define COMPARE_BRANCH_CYCLES 2
+#endif
+#ifndef MISS_CYCLES
+#define MISS_CYCLES       10
+#endif
+#ifndef WRITE_BACK_CYCLES
+#define WRITE_BACK_CYCLES 10
+#endif
+
+struct timing {
+  uint64_t cycles,
+           load_use,             /* stall cycles by cause */
+           branch,
+           miss,
+           write_back;
+  int loaded;                    /* register the last instruction loaded, or 0 */
+};
+
+void timing_create( struct machine *m ){
+  m->timing = calloc( 1, sizeof( struct timing ) );
+  if( !m->timing ) out_of_memory();
+}
+
+void timing_free( struct machine *m ){
+  free( m->timing );
+  m->timing = NULL;
+}
+
+/* whether the instruction reads register r */
+int reads_reg( struct decoded *di, int r ){
+  switch( di->op1 ){
+    case 0x04: case 0x07: case 0x14: case 0x16:
+    case 0x24: case 0x26: case 0x28: case 0x2a: case 0x2e:
+      return ( di->s1 == r ) || ( di->s2 == r );
+    case 0x05: case 0x15: case 0x17:
+    case 0x25: case 0x27: case 0x29: case 0x2b: case 0x2f:
+      return di->s2 == r;
+  }
+  return 0;
+}
+
+void timing_note( struct machine *m, unsigned int pc, int taken, int misses, int write_backs ){
+  struct timing *t = m->timing;
+  struct decoded *di = decoded_at( m, pc );
+
+  t->cycles++;
+  if( t->loaded && reads_reg( di, t->loaded ) ){
+    t->load_use += LOAD_USE_CYCLES;
+    t->cycles += LOAD_USE_CYCLES;
+  }
+  t->loaded = ( ( di->op1 == 0x04 ) || ( di->op1 == 0x05 ) ) ? di->d : 0;
+
+  if( taken ){
+    int penalty = ( ( di->op1 >= 0x14 ) && ( di->op1 <= 0x17 ) ) ? COMPARE_BRANCH_CYCLES : BRANCH_CYCLES;
+    t->branch += penalty;
+    t->cycles += penalty;
+  }
+  t->miss       += misses * MISS_CYCLES;
+  t->write_back += write_backs * WRITE_BACK_CYCLES;
+  t->cycles     += misses * MISS_CYCLES + write_backs * WRITE_BACK_CYCLES;
+}
+
+void print_timing( struct machine *m ){
+  struct timing *t = m->timing;
+  fprintf( m->out, "timing (in decimal):\n" );
+  fprintf( m->out, "  cycles              = %llu\n", (unsigned long long)t->cycles );
+  fprintf( m->out, "  CPI                 = %.3f\n",
+    m->inst_fetches ? (double)t->cycles / (unsigned)m->inst_fetches : 0.0 );
+  fprintf( m->out, "  load-use stalls     = %llu\n", (unsigned long long)t->load_use );
+  fprintf( m->out, "  branch stalls       = %llu\n", (unsigned long long)t->branch );
+  fprintf( m->out, "  cache miss stalls   = %llu\n", (unsigned long long)t->miss );
+  fprintf( m->out, "  write back stalls   = %llu\n", (unsigned long long)t->write_back );
+}
+
+/* ILP limit study: schedule the dynamic dependency graph as it runs.
+   Every instruction takes one cycle and starts once the registers, cc
+   and memory words it reads are ready, with perfect branch prediction,
+   perfect memory disambiguation by word address and unlimited issue
+   width.  A window of w instructions also keeps an instruction from
+   starting before the one w earlier has retired, retiring in order.
+   Without renaming, a write further waits for the last write of its
+   destination to finish and its last read to start.  One model runs
+   for each window size with and without renaming */
+
+#define NUM_WINDOWS    5
+#define NUM_ILP_MODELS ( 2 * NUM_WINDOWS )
+#define NUM_OP_CLASSES 8
+
+const int ilp_windows[NUM_WINDOWS] = { 16, 64, 256, 1024, 0 };   /* 0 is unlimited */
+
+const char *op_class_names[NUM_OP_CLASSES] = {
+  "loads", "stores", "add and subtract", "shifts",
+  "compare and branch", "branch on cc", "br", "halt and other"
+};
+
+struct ilp_model {
+  int window,                  /* instructions, or 0 for unlimited  */
+      renamed;
+  unsigned int reg[32],        /* cycle each value is ready         */
+               reg_read[32],   /* cycle of its last read            */
+               cc,
+               cc_read,
+               retire,         /* of the last instruction           */
+               *ring;          /* retire cycles of the last window  */
+};
+
+/* the cycles of one memory word in each model */
+struct ilp_word {
+  unsigned int addr,           /* word address + 1, 0 if empty      */
+               ready[NUM_ILP_MODELS],
+               read[NUM_ILP_MODELS];
+};
+
+struct ilp {
+  struct ilp_model models[NUM_ILP_MODELS];
+  struct ilp_word *words;      /* open addressing on the address    */
+  unsigned int num_words,
+               size;           /* a power of two                    */
+  uint64_t count,
+           mix[NUM_OP_CLASSES];
+};
+
+void ilp_create( struct machine *m ){
+  struct ilp *p = calloc( 1, sizeof( struct ilp ) );
+  if( !p ) out_of_memory();
+  for( int i = 0; i < NUM_ILP_MODELS; i++ ){
+    struct ilp_model *model = &p->models[ i ];
+    model->window = ilp_windows[ i / 2 ];
+    model->renamed = !( i & 1 );
+    if( model->window ) model->ring = calloc( model->window, sizeof( unsigned int ) );
+  }
+  p->size = 1 << 16;
+  p->words = calloc( p->size, sizeof( struct ilp_word ) );
+  m->ilp = p;
+}
+
+void ilp_free( struct machine *m ){
+  if( !m->ilp ) return;
+  for( int i = 0; i < NUM_ILP_MODELS; i++ ) free( m->ilp->models[ i ].ring );
+  free( m->ilp->words );
+  free( m->ilp );
+  m->ilp = NULL;
+}
+
+struct ilp_word *ilp_word( struct ilp *p, unsigned int addr ){
+  unsigned int key = ( addr >> 2 ) + 1, i;
+
+  if( 2 * ( p->num_words + 1 ) > p->size ){
+    struct ilp_word *old = p->words;
+    unsigned int old_size = p->size;
+    p->size *= 2;
+    p->words = calloc( p->size, sizeof( struct ilp_word ) );
+    if( !p->words ) out_of_memory();
+    for( unsigned int j = 0; j < old_size; j++ ){
+      if( !old[ j ].addr ) continue;
+      for( i = old[ j ].addr * 2654435761u & ( p->size - 1 ); p->words[ i ].addr; i = ( i + 1 ) & ( p->size - 1 ) );
+      p->words[ i ] = old[ j ];
+    }
+    free( old );
+  }
+  for( i = key * 2654435761u & ( p->size - 1 ); p->words[ i ].addr; i = ( i + 1 ) & ( p->size - 1 ) ){
+    if( p->words[ i ].addr == key ) return &p->words[ i ];
+  }
+  p->words[ i ].addr = key;
+  p->num_words++;
+  return &p->words[ i ];
+}
+
+int op_class( int op1 ){
+  switch( op1 ){
+    case 0x04: case 0x05:                       return 0;
+    case 0x07:                                  return 1;
+    case 0x24: case 0x25: case 0x26: case 0x27: return 2;
+    case 0x28: case 0x29: case 0x2a: case 0x2b:
+    case 0x2e: case 0x2f:                       return 3;
+    case 0x14: case 0x15: case 0x16: case 0x17: return 4;
+    case 0x1c: case 0x1e:                       return 5;
+    case 0x1a:                                  return 6;
+  }
+  return 7;
+}
+
+#define LATER( a, b ) do{ if( ( b ) > ( a ) ) ( a ) = ( b ); }while( 0 )
+
+/* called after the instruction at pc ran; addr is its data address */
+void ilp_note( struct machine *m, unsigned int pc, unsigned int addr ){
+  struct ilp *p = m->ilp;
+  struct decoded *di = decoded_at( m, pc );
+  int class = op_class( di->op1 ), src[2], num_src = 0, dest = 0;
+  int reads_cc = ( class == 5 ), writes_cc = ( class == 2 );
+  struct ilp_word *w = NULL;
+
+  p->mix[ class ]++;
+  if( reads_reg( di, di->s1 ) ) src[ num_src++ ] = di->s1;
+  if( reads_reg( di, di->s2 ) ) src[ num_src++ ] = di->s2;
+  if( ( class == 0 ) || ( class == 2 ) || ( class == 3 ) ) dest = di->d;
+  if( ( class == 0 ) || ( class == 1 ) ) w = ilp_word( p, addr );
+
+  for( int i = 0; i < NUM_ILP_MODELS; i++ ){
+    struct ilp_model *model = &p->models[ i ];
+    unsigned int start = 0, *slot = NULL;
+
+    for( int j = 0; j < num_src; j++ ) LATER( start, model->reg[ src[ j ] ] );
+    if( reads_cc ) LATER( start, model->cc );
+    if( class == 0 ) LATER( start, w->ready[ i ] );
+    if( model->window ){
+      slot = &model->ring[ p->count % model->window ];
+      LATER( start, *slot );
+    }
+    if( !model->renamed ){
+      if( dest ){
+        LATER( start, model->reg[ dest ] );
+        LATER( start, model->reg_read[ dest ] );
+      }
+      if( writes_cc ){
+        LATER( start, model->cc );
+        LATER( start, model->cc_read );
+      }
+      if( class == 1 ){
+        LATER( start, w->ready[ i ] );
+        LATER( start, w->read[ i ] );
+      }
+      for( int j = 0; j < num_src; j++ ) LATER( model->reg_read[ src[ j ] ], start );
+      if( reads_cc ) LATER( model->cc_read, start );
+      if( class == 0 ) LATER( w->read[ i ], start );
+    }
+
+    if( dest ) model->reg[ dest ] = start + 1;
+    if( writes_cc ) model->cc = start + 1;
+    if( class == 1 ) w->ready[ i ] = start + 1;
+    LATER( model->retire, start + 1 );
+    if( slot ) *slot = model->retire;
+  }
+  p->count++;
+}
+
+void print_ilp( struct machine *m ){
+  struct ilp *p = m->ilp;
+  unsigned int path = p->models[ NUM_ILP_MODELS - 2 ].retire;
+
+  fprintf( m->out, "ILP limits (in decimal):\n" );
+  fprintf( m->out, "  instructions        = %llu\n", (unsigned long long)p->count );
+  fprintf( m->out, "  critical path       = %u cycles\n", path );
+  fprintf( m->out, "  ideal IPC           = %.2f\n", path ? (double)p->count / path : 0.0 );
+  fprintf( m->out, "  window    cycles renamed  IPC      cycles not renamed  IPC\n" );
+  for( int i = 0; i < NUM_ILP_MODELS; i += 2 ){
+    struct ilp_model *a = &p->models[ i ], *b = &p->models[ i + 1 ];
+    if( a->window ){
+      fprintf( m->out, "  %8d", a->window );
+    }else{
+      fprintf( m->out, "  %8s", "no limit" );
+    }
+    fprintf( m->out, "  %14u  %7.2f  %18u  %7.2f\n",
+      a->retire, a->retire ? (double)p->count / a->retire : 0.0,
+      b->retire, b->retire ? (double)p->count / b->retire : 0.0 );
+  }
+  fprintf( m->out, "instruction mix (in decimal):\n" );
+  for( int i = 0; i < NUM_OP_CLASSES; i++ ){
+    fprintf( m->out, "  %-19s = %llu (%.1f%%)\n", op_class_names[ i ], (unsigned long long)p->mix[ i ],
+      p->count ? 100.0 * p->mix[ i ] / p->count : 0.0 );
+  }
+}
+
+/* miss-ratio curves: the LRU stack distance of each data reference,
+   in lines of the data cache's size, for each set count from 1 to
+   MRC_MAX_SETS.  The distance is the number of other lines of the set
+   referenced since the line's last reference, so the reference hits in
+   an LRU cache of that many sets and w ways exactly when it is below w,
+   and one run gives the miss ratio of every capacity.  Each set keeps
+   a Fenwick tree over its own reference times holding a 1 at the last
+   reference of each of its lines: the distance is the number of 1s
+   after the line's time, found in O(log n).  When the times of a set
+   run out its lines are renumbered in order, keeping the tree about
+   twice the size of the set's lines */
+
+#define MRC_SET_COUNTS 11                        /* 1, 2, 4, ... sets */
+#define MRC_MAX_SETS   ( 1 << ( MRC_SET_COUNTS - 1 ) )
+#define MRC_BINS       33    /* distance 0, then [2^(b-1), 2^b) in bin b */
+#define MRC_MIN_TIMES  16
+
+struct mrc_line {
+  unsigned int line,                   /* address >> offset bits        */
+               last[MRC_SET_COUNTS];   /* time of its last reference    */
+};
+
+struct mrc_set {
+  unsigned int *tree,        /* Fenwick tree, 1-based, over the times   */
+               *owner,       /* line referenced at each time            */
+               size,         /* times before the set is renumbered      */
+               now,          /* next time                               */
+               live;         /* lines of the set                        */
+};
+
+struct mrc {
+  int offset_bits;
+  struct mrc_set *sets[MRC_SET_COUNTS];  /* 2^c sets for set count c     */
+  struct mrc_line *lines;                /* in order of first reference  */
+  unsigned int num_lines,
+               max_lines,
+               *index,                   /* line number + 1 by hash      */
+               index_size;               /* a power of two               */
+  uint64_t count,
+           cold,
+           bins[MRC_SET_COUNTS][MRC_BINS];
+};
+
+void *mrc_alloc( size_t size ){
+  void *p = calloc( 1, size );
+  if( !p ) out_of_memory();
+  return p;
+}
+
+void mrc_set_size( struct mrc_set *st, unsigned int size ){
+  free( st->tree );
+  free( st->owner );
+  st->size  = size;
+  st->tree  = mrc_alloc( ( size + 1 ) * sizeof( unsigned int ) );
+  st->owner = mrc_alloc( size * sizeof( unsigned int ) );
+}
+
+void mrc_create( struct machine *m ){
+  struct mrc *p = mrc_alloc( sizeof( struct mrc ) );
+
+  p->offset_bits = m->cache.offset_bits;
+  for( int c = 0; c < MRC_SET_COUNTS; c++ ){
+    p->sets[ c ] = mrc_alloc( ( 1 << c ) * sizeof( struct mrc_set ) );
+    for( int s = 0; s < ( 1 << c ); s++ ) mrc_set_size( &p->sets[ c ][ s ], MRC_MIN_TIMES );
+  }
+  p->index_size = 1 << 16;
+  p->index = mrc_alloc( p->index_size * sizeof( unsigned int ) );
+  m->mrc = p;
+}
+
+void mrc_free( struct machine *m ){
+  struct mrc *p = m->mrc;
+  if( !p ) return;
+  for( int c = 0; c < MRC_SET_COUNTS; c++ ){
+    for( int s = 0; s < ( 1 << c ); s++ ){
+      free( p->sets[ c ][ s ].tree );
+      free( p->sets[ c ][ s ].owner );
+    }
+    free( p->sets[ c ] );
+  }
+  free( p->lines );
+  free( p->index );
+  free( p );
+  m->mrc = NULL;
+}
+
+void fenwick_add( unsigned int *tree, unsigned int size, unsigned int t, int delta ){
+  for( t++; t <= size; t += t & -t ) tree[ t ] += delta;
+}
+
+/* the 1s before time t */
+unsigned int fenwick_prefix( unsigned int *tree, unsigned int t ){
+  unsigned int sum = 0;
+  for( ; t; t -= t & -t ) sum += tree[ t ];
+  return sum;
+}
+
+/* give the lines of a set of set count c the times 0 to live - 1, in
+   the order of their last references */
+void mrc_renumber( struct mrc *p, int c, struct mrc_set *st ){
+  unsigned int *owner = st->owner, now = st->now, t = 0;
+
+  st->owner = NULL;
+  mrc_set_size( st, ( 2 * st->live > MRC_MIN_TIMES ) ? 2 * st->live : MRC_MIN_TIMES );
+  for( unsigned int old = 0; old < now; old++ ){
+    struct mrc_line *l = &p->lines[ owner[ old ] ];
+    if( l->last[ c ] != old ) continue;      /* referenced again since */
+    l->last[ c ] = t;
+    st->owner[ t++ ] = owner[ old ];
+  }
+  for( unsigned int i = 1; i <= st->size; i++ ){     /* 1s at the times below t */
+    unsigned int low = i - ( i & -i );
+    st->tree[ i ] = ( low < t ) ? ( ( i < t ) ? i : t ) - low : 0;
+  }
+  st->now = t;
+  free( owner );
+}
+
+/* the line's number in lines[], adding it if it is new */
+unsigned int mrc_line( struct mrc *p, unsigned int line, int *new ){
+  unsigned int i, mask;
+
+  if( 2 * ( p->num_lines + 1 ) > p->index_size ){
+    free( p->index );
+    p->index_size *= 2;
+    p->index = mrc_alloc( p->index_size * sizeof( unsigned int ) );
+    mask = p->index_size - 1;
+    for( unsigned int j = 0; j < p->num_lines; j++ ){
+      for( i = p->lines[ j ].line * 2654435761u & mask; p->index[ i ]; i = ( i + 1 ) & mask );
+      p->index[ i ] = j + 1;
+    }
+  }
+  mask = p->index_size - 1;
+  for( i = line * 2654435761u & mask; p->index[ i ]; i = ( i + 1 ) & mask ){
+    if( p->lines[ p->index[ i ] - 1 ].line == line ){
+      *new = 0;
+      return p->index[ i ] - 1;
+    }
+  }
+  if( p->num_lines == p->max_lines ){
+    p->max_lines = p->max_lines ? 2 * p->max_lines : 1024;
+    p->lines = realloc( p->lines, p->max_lines * sizeof( struct mrc_line ) );
+    if( !p->lines ) out_of_memory();
+  }
+  p->lines[ p->num_lines ].line = line;
+  p->index[ i ] = p->num_lines + 1;
+  *new = 1;
+  return p->num_lines++;
+}
+
+void mrc_note( struct machine *m, unsigned int addr ){
+  struct mrc *p = m->mrc;
+  unsigned int line = addr >> p->offset_bits;
+  int new;
+  unsigned int id = mrc_line( p, line, &new );
+  struct mrc_line *l = &p->lines[ id ];
+
+  p->count++;
+  p->cold += new;
+  for( int c = 0; c < MRC_SET_COUNTS; c++ ){
+    struct mrc_set *st = &p->sets[ c ][ line & ( ( 1u << c ) - 1 ) ];
+    if( st->now == st->size ) mrc_renumber( p, c, st );
+    if( new ){
+      st->live++;
+    }else{
+      unsigned int distance = st->live - fenwick_prefix( st->tree, l->last[ c ] + 1 );
+      p->bins[ c ][ distance ? 32 - __builtin_clz( distance ) : 0 ]++;
+      fenwick_add( st->tree, st->size, l->last[ c ], -1 );
+    }
+    fenwick_add( st->tree, st->size, st->now, 1 );
+    st->owner[ st->now ] = id;
+    l->last[ c ] = st->now++;
+  }
+}
+
+/* for each set count, the misses of each associativity up to the one
+   where only cold misses are left */
+void print_mrc( struct machine *m ){
+  struct mrc *p = m->mrc;
+  unsigned int line_size = 1u << p->offset_bits;
+
+  fprintf( m->out, "miss-ratio curves (in decimal), LRU with %u-byte lines:\n", line_size );
+  fprintf( m->out, "  references          = %llu\n", (unsigned long long)p->count );
+  fprintf( m->out, "  cold misses         = %llu\n", (unsigned long long)p->cold );
+  fprintf( m->out, "      sets      ways      capacity        misses  miss ratio\n" );
+  for( int c = 0; c < MRC_SET_COUNTS; c++ ){
+    uint64_t hits = 0, reused = p->count - p->cold;
+    for( int b = 0; b < MRC_BINS; b++ ){
+      uint64_t capacity = ( (uint64_t)line_size << c ) << b;
+      if( capacity > ( 1u << 30 ) ) break;
+      hits += p->bins[ c ][ b ];
+      fprintf( m->out, "  %8u  %8u  %12llu  %12llu  %9.2f%%\n", 1u << c, 1u << b,
+        (unsigned long long)capacity, (unsigned long long)( p->count - hits ),
+        p->count ? 100.0 * ( p->count - hits ) / p->count : 0.0 );
+      if( hits == reused ) break;
+    }
+  }
+}
+
+/* replacement policies side by side, for -R: a cache of the data
+   cache's geometry under each policy sees every data reference, and
+   the line numbers referenced are recorded for Belady's OPT, which
+   needs the future.  At the end one backward pass finds the next use
+   of each reference, and OPT replays the stream replacing the line of
+   a full set that is used again furthest ahead, or never.  OPT is
+   counted without write backs, which it does not try to avoid */
+
+#define NEVER 0xffffffffu    /* next use of a line not referenced again */
+
+struct policies {
+  struct cache caches[NUM_POLICIES];
+  unsigned int *refs,        /* line number of each reference           */
+               num_refs,
+               max_refs;
+};
+
+void policies_create( struct machine *m ){
+  struct policies *p = calloc( 1, sizeof( struct policies ) );
+  if( !p ) out_of_memory();
+  for( int i = 0; i < NUM_POLICIES; i++ ){
+    cache_configure( &p->caches[ i ], m->cache.sets, m->cache.ways, m->cache.line_size );
+    p->caches[ i ].policy = i;
+  }
+  m->policies = p;
+}
+
+void policies_free( struct machine *m ){
+  if( !m->policies ) return;
+  for( int i = 0; i < NUM_POLICIES; i++ ) cache_free( &m->policies->caches[ i ] );
+  free( m->policies->refs );
+  free( m->policies );
+  m->policies = NULL;
+}
+
+void policies_note( struct machine *m, unsigned int addr, unsigned int type ){
+  struct policies *p = m->policies;
+
+  for( int i = 0; i < NUM_POLICIES; i++ ) cache_access( &p->caches[ i ], addr, type );
+  if( p->num_refs == p->max_refs ){
+    p->max_refs = p->max_refs ? 2 * p->max_refs : 1 << 16;
+    p->refs = realloc( p->refs, p->max_refs * sizeof( unsigned int ) );
+    if( !p->refs ) out_of_memory();
+  }
+  p->refs[ p->num_refs++ ] = addr >> m->cache.offset_bits;
+}
+
+/* the next reference to the line of each reference, or NEVER */
+unsigned int *next_uses( struct policies *p ){
+  unsigned int *next = malloc( ( p->num_refs + 1 ) * sizeof( unsigned int ) ),
+               size = 1 << 16, used = 0,
+               *keys = calloc( size, sizeof( unsigned int ) ),     /* line + 1 */
+               *last = malloc( size * sizeof( unsigned int ) ),    /* its next reference */
+               i, j;
+
+  if( !next || !keys || !last ) out_of_memory();
+  for( unsigned int r = p->num_refs; r-- > 0; ){
+    unsigned int key = p->refs[ r ] + 1;
+    if( 2 * ( used + 1 ) > size ){
+      unsigned int *old_keys = keys, *old_last = last, old_size = size;
+      size *= 2;
+      keys = calloc( size, sizeof( unsigned int ) );
+      last = malloc( size * sizeof( unsigned int ) );
+      if( !keys || !last ) out_of_memory();
+      for( j = 0; j < old_size; j++ ){
+        if( !old_keys[ j ] ) continue;
+        for( i = old_keys[ j ] * 2654435761u & ( size - 1 ); keys[ i ]; i = ( i + 1 ) & ( size - 1 ) );
+        keys[ i ] = old_keys[ j ];
+        last[ i ] = old_last[ j ];
+      }
+      free( old_keys );
+      free( old_last );
+    }
+    for( i = key * 2654435761u & ( size - 1 ); keys[ i ] && ( keys[ i ] != key ); i = ( i + 1 ) & ( size - 1 ) );
+    if( keys[ i ] ){
+      next[ r ] = last[ i ];
+    }else{
+      keys[ i ] = key;
+      used++;
+      next[ r ] = NEVER;
+    }
+    last[ i ] = r;
+  }
+  free( keys );
+  free( last );
+  return next;
+}
+
+/* misses of Belady's OPT in a cache of the data cache's geometry */
+uint64_t opt_misses( struct machine *m ){
+  struct policies *p = m->policies;
+  unsigned int sets = m->cache.sets, ways = m->cache.ways,
+               *next = next_uses( p ),
+               *line = malloc( sets * ways * sizeof( unsigned int ) ),
+               *use  = malloc( sets * ways * sizeof( unsigned int ) );  /* next use of each line */
+  unsigned char *valid = calloc( sets * ways, 1 );
+  uint64_t misses = 0;
+
+  if( !line || !use || !valid ) out_of_memory();
+  for( unsigned int r = 0; r < p->num_refs; r++ ){
+    unsigned int first = ( p->refs[ r ] & ( sets - 1 ) ) * ways, way, victim = first;
+    for( way = first; way < first + ways; way++ ){
+      if( valid[ way ] && ( line[ way ] == p->refs[ r ] ) ) break;
+    }
+    if( way == first + ways ){
+      misses++;
+      for( way = first; way < first + ways; way++ ){
+        if( !valid[ way ] ) break;
+        if( use[ way ] > use[ victim ] ) victim = way;
+      }
+      if( way == first + ways ) way = victim;
+      valid[ way ] = 1;
+      line[ way ] = p->refs[ r ];
+    }
+    use[ way ] = next[ r ];
+  }
+  free( next );
+  free( line );
+  free( use );
+  free( valid );
+  return misses;
+}
+
+void print_policies( struct machine *m ){
+  struct policies *p = m->policies;
+  uint64_t opt = opt_misses( m ), refs = p->num_refs;
+
+  fprintf( m->out, "replacement policies (in decimal), %u sets of %u ways, %u-byte lines:\n",
+    m->cache.sets, m->cache.ways, m->cache.line_size );
+  fprintf( m->out, "  policy          hits      misses  hit rate  write backs  misses over opt\n" );
+  for( int i = 0; i < NUM_POLICIES; i++ ){
+    struct cache *c = &p->caches[ i ];
+    fprintf( m->out, "  %-6s  %10u  %10u  %7.2f%%  %11u  %14.1f%%\n", policy_names[ i ],
+      c->hits, c->misses, refs ? 100.0 * c->hits / refs : 0.0, c->write_backs,
+      opt ? 100.0 * ( (double)c->misses / opt - 1 ) : 0.0 );
+  }
+  fprintf( m->out, "  %-6s  %10llu  %10llu  %7.2f%%  %11s  %14s\n", "opt",
+    (unsigned long long)( refs - opt ), (unsigned long long)opt,
+    refs ? 100.0 * ( refs - opt ) / refs : 0.0, "-", "-" );
+}
+
+/* one instruction of the instrumented engine: the basic engine without
+   text output, fetching through the instruction cache of -H, reporting
+   each instruction to the profiler, the timing model and the ILP study,
+   each data reference to the miss-ratio curves and the replacement
+   policies and each branch to the predictors */
+void step_instrumented( struct machine *m ){
+  int memory, writes, branches, taken, misses, write_backs;
+  unsigned int pc = m->fip;
+
+  memory      = m->memory_reads + m->memory_writes;
+  writes      = m->memory_writes;
+  branches    = m->branches;
+  taken       = m->taken;
+  misses      = m->cache.misses;
+  write_backs = m->cache.write_backs;
+  if( m->hier ) cache_access( &m->hier->icache, pc, 0 );
+  step( m );
+
+  if( m->timing ){
+    timing_note( m, pc, m->taken != taken, m->cache.misses - misses,
+                 m->cache.write_backs - write_backs );
+  }
+  if( m->ilp ) ilp_note( m, pc, m->eff_addr );
+  if( m->memory_reads + m->memory_writes != memory ){
+    if( m->mrc ) mrc_note( m, m->eff_addr );
+    if( m->policies ) policies_note( m, m->eff_addr, m->memory_writes != writes );
+  }
+
+  if( m->prof ){
+    profile_note( m, pc, m->memory_reads + m->memory_writes - memory,
+                  m->branches != branches, m->taken != taken );
+  }
+  if( m->bp && ( m->branches != branches ) ) predict_note( m, pc, m->taken != taken );
+}
+
+void run_instrumented( struct machine *m ){
+  while( !m->halt_flag ) step_instrumented( m );
+  if( m->prof ) profile_end( m );
+}
+
+/* sampled simulation: repeatedly run n instructions functionally with
+   the cache switched off, w instructions through the cache and timing
+   model to warm them, and m instructions measured in detail.  Each
+   measured interval gives one hit rate and one CPI; the estimate is
+   their mean, with a 95% confidence interval from their spread.  A run
+   that ends inside an interval drops it unless no interval finished */
+
+struct sample_sum {
+  int n;
+  double sum, sum_sq;
+};
+
+void sample_add( struct sample_sum *s, double x ){
+  s->n++;
+  s->sum += x;
+  s->sum_sq += x * x;
+}
+
+void sample_print( FILE *out, const char *name, struct sample_sum *s, double scale, const char *unit ){
+  if( !s->n ){
+    fprintf( out, "  %-15s = none measured\n", name );
+    return;
+  }
+  double mean = s->n ? s->sum / s->n : 0.0,
+         var = ( s->n > 1 ) ? ( s->sum_sq - s->n * mean * mean ) / ( s->n - 1 ) : 0.0,
+         half = ( s->n > 1 ) ? 1.96 * sqrt( var > 0.0 ? var : 0.0 ) / sqrt( s->n ) : 0.0;
+  fprintf( out, "  %-15s = %.3f%s +- %.3f%s\n", name, scale * mean, unit, scale * half, unit );
+}
+
+struct sampling {
+  int ff, warm, measure,        /* interval lengths              */
+      intervals;                /* measured intervals used       */
+  uint64_t measured;            /* instructions in those         */
+  struct sample_sum hit_rate, cpi;
+};
+
+void run_sampled( struct machine *m, struct sampling *sp ){
+  struct sample_sum hit_rate = { 0 }, cpi = { 0 }, last_hit_rate = { 0 }, last_cpi = { 0 };
+  int ff = sp->ff, warm = sp->warm, measure = sp->measure;
+  uint64_t measured = 0;
+  int samples = 0;
+
+  timing_create( m );
+  while( !m->halt_flag ){
+    m->cache.off = 1;
+    for( int i = 0; ( i < ff ) && !m->halt_flag; i++ ) step( m );
+    m->cache.off = 0;
+    m->timing->loaded = 0;
+    for( int i = 0; ( i < warm ) && !m->halt_flag; i++ ) step_instrumented( m );
+
+    int start = m->inst_fetches,
+        hits = m->cache.hits,
+        accesses = m->cache.hits + m->cache.misses;
+    uint64_t cycles = m->timing->cycles;
+    for( int i = 0; ( i < measure ) && !m->halt_flag; i++ ) step_instrumented( m );
+
+    int count = m->inst_fetches - start;
+    accesses = m->cache.hits + m->cache.misses - accesses;
+    if( count == 0 ) continue;
+
+    /* an interval cut short by the halt only counts if it is the only one */
+    struct sample_sum *h = ( count == measure ) ? &hit_rate : &last_hit_rate,
+                      *c = ( count == measure ) ? &cpi : &last_cpi;
+    if( accesses ) sample_add( h, (double)( m->cache.hits - hits ) / accesses );
+    sample_add( c, (double)( m->timing->cycles - cycles ) / count );
+    if( count == measure ){
+      samples++;
+      measured += count;
+    }else if( !samples ){
+      measured += count;
+    }
+  }
+  m->cache.off = 0;
+
+  sp->intervals = samples ? samples : last_cpi.n;
+  sp->measured  = measured;
+  sp->hit_rate  = samples ? hit_rate : last_hit_rate;
+  sp->cpi       = samples ? cpi : last_cpi;
+}
+
+void print_sampling( struct machine *m, struct sampling *sp ){
+  fprintf( m->out, "sampling (in decimal):\n" );
+  fprintf( m->out, "  intervals       = %d, each %d fast-forward, %d warm-up, %d measured\n",
+    sp->intervals, sp->ff, sp->warm, sp->measure );
+  fprintf( m->out, "  measured        = %llu of %d instructions\n", (unsigned long long)sp->measured, m->inst_fetches );
+  sample_print( m->out, "cache hit rate", &sp->hit_rate, 100.0, "%" );
+  sample_print( m->out, "CPI", &sp->cpi, 1.0, "" );
+  fprintf( m->out, "  (95%% confidence; the cache statistics above count only warm-up\n" );
+  fprintf( m->out, "   and measured instructions)\n" );
+}
+
+/* statistics export: -O writes every counter to a file as JSON or CSV,
+   and with -i n also a sample of them each time another n instructions
+   have run.  Samples are cumulative, so a dashboard takes differences
+   between rows to see a phase; the last row or the "statistics" object
+   is the state at halt */
+
+#define NUM_COUNTERS 10
+
+const char *counter_names[NUM_COUNTERS] = {
+  "instructions", "reads", "writes", "branches", "taken",
+  "cache_reads", "cache_writes", "hits", "misses", "write_backs"
+};
+
+void collect_counters( struct machine *m, int *c ){
+  c[0] = m->inst_fetches;
+  c[1] = m->memory_reads;
+  c[2] = m->memory_writes;
+  c[3] = m->branches;
+  c[4] = m->taken;
+  c[5] = m->cache.cache_reads;
+  c[6] = m->cache.cache_writes;
+  c[7] = m->cache.hits;
+  c[8] = m->cache.misses;
+  c[9] = m->cache.write_backs;
+}
+
+struct export {
+  FILE *f;
+  int csv,                   /* 0 for JSON, 1 for CSV             */
+      interval,              /* instructions between samples      */
+      samples,               /* written so far                    */
+      last;                  /* instruction count of the last one */
+};
+
+void export_row( struct export *x, int *c ){
+  if( x->csv ){
+    for( int i = 0; i < NUM_COUNTERS; i++ ) fprintf( x->f, "%s%d", i ? "," : "", c[ i ] );
+    fprintf( x->f, "\n" );
+  }else{
+    fprintf( x->f, "{ " );
+    for( int i = 0; i < NUM_COUNTERS; i++ ) fprintf( x->f, "%s\"%s\": %d", i ? ", " : "", counter_names[ i ], c[ i ] );
+    fprintf( x->f, " }" );
+  }
+}
+
+void export_open( struct machine *m, struct export *x, const char *name ){
+  x->f = fopen( name, "w" );
+  if( !x->f ){
+    fprintf( m->out, "cannot write %s\n", name );
+    fail();
+  }
+  x->samples = 0;
+  x->last = -1;
+  if( x->csv ){
+    for( int i = 0; i < NUM_COUNTERS; i++ ) fprintf( x->f, "%s%s", i ? "," : "", counter_names[ i ] );
+    fprintf( x->f, "\n" );
+  }else{
+    fprintf( x->f, "{\n  \"interval\": %d,\n  \"samples\": [", x->interval );
+  }
+}
+
+void export_sample( struct machine *m, struct export *x ){
+  int c[NUM_COUNTERS];
+
+  collect_counters( m, c );
+  if( !x->csv ) fprintf( x->f, "%s\n    ", x->samples ? "," : "" );
+  export_row( x, c );
+  x->samples++;
+  x->last = m->inst_fetches;
+}
+
+/* a CSV file ends with the row at halt, unless the last sample fell on
+   it; JSON gives it separately */
+void export_close( struct machine *m, struct export *x ){
+  int c[NUM_COUNTERS];
+
+  if( x->csv ){
+    if( x->last != m->inst_fetches ) export_sample( m, x );
+  }else{
+    collect_counters( m, c );
+    fprintf( x->f, "%s],\n  \"statistics\": ", x->samples ? "\n  " : "" );
+    export_row( x, c );
+    fprintf( x->f, "\n}\n" );
+  }
+  fclose( x->f );
+}
+
+/* run to halt one instruction at a time, sampling on each multiple of
+   the interval; a run resumed from a snapshot keeps to the same grid */
+void run_intervals( struct machine *m, struct export *x, int instrumented ){
+  int next = ( m->inst_fetches / x->interval + 1 ) * x->interval;
+
+  while( !m->halt_flag ){
+    if( instrumented ){
+      step_instrumented( m );
+    }else{
+      step( m );
+    }
+    if( m->inst_fetches == next ){
+      export_sample( m, x );
+      next += x->interval;
+    }
+  }
+  if( m->prof ) profile_end( m );
+}
+
+/* direct-threaded engine: each record caches the address of its handler
+   label, and handler bodies are inlined without the verbose tests, so it
+   is only used when no trace is requested; opcodes without a label here,
+   including the ones that print even when not tracing (subs immediate,
+   shr), go through their normal handlers.
+
+   Common pairs are fused: when a record's label is chosen and the next
+   word on the page completes one of
+
+     adds immediate       then btne or btnei   (count down and loop)
+     adds, subs           then bc or bnc       (compare and branch)
+     ld.l                 then ld.l
+
+   the first record gets a label that runs both instructions with one
+   dispatch, jumping straight into the second one's body.  The fused
+   label checks that the second record is still valid, and decoding a
+   word clears the label of the word before it, so a store into the pair
+   splits it again */
+void run_threaded( struct machine *m ){
+  static void *labels[64] = {
+    [0x00] = &&op_halt,
+    [0x04] = &&op_ld,    [0x05] = &&op_ldi,   [0x07] = &&op_st,
+    [0x14] = &&op_btne,  [0x15] = &&op_btnei, [0x16] = &&op_bte,   [0x17] = &&op_btei,
+    [0x1a] = &&op_br,    [0x1c] = &&op_bc,    [0x1e] = &&op_bnc,
+    [0x24] = &&op_adds,  [0x25] = &&op_addsi, [0x26] = &&op_subs,
+    [0x28] = &&op_shl,   [0x29] = &&op_shli,  [0x2b] = &&op_shri,
+    [0x2e] = &&op_shra,  [0x2f] = &&op_shrai
+  };
+  struct decoded *di, *decoded = NULL;   /* records of the page at vpn */
+  struct page *page;
+  unsigned int vpn = ~0u;
+  int addr;
+
+#define DISPATCH() do{                                    \
+    m->reg[ 0 ] = 0;                                      \
+    if( ( (unsigned)m->fip >> PAGE_SHIFT ) != vpn ){      \
+      vpn = (unsigned)m->fip >> PAGE_SHIFT;               \
+      decoded = decoded_at( m, vpn << PAGE_SHIFT );       \
+    }                                                     \
+    di = &decoded[ ( m->fip >> 2 ) & ( PAGE_WORDS - 1 ) ];\
+    if( !di->valid ) predecode( m, m->fip );              \
+    if( !di->target ) goto retarget;                      \
+    m->xip = m->fip;                                      \
+    m->fip = m->xip + 4;                                  \
+    m->inst_fetches++;                                    \
+    goto *di->target;                                     \
+  }while( 0 )
+
+/* step from the first record of a fused pair to the second; a pair whose
+   second word was stored to runs its first instruction alone */
+#define FUSED( first ) if( !di[ 1 ].valid ) goto first
+#define NEXT_IN_PAIR() do{                                \
+    m->reg[ 0 ] = 0;                                      \
+    di++;                                                 \
+    m->xip = m->fip;                                      \
+    m->fip = m->xip + 4;                                  \
+    m->inst_fetches++;                                    \
+  }while( 0 )
+
+#define LOAD( a ) do{                                     \
+    addr = ( a );                                         \
+    cache_access( &m->cache, addr, 0 );                   \
+    m->reg[ di->d ] = *mem_word( m, addr );               \
+    m->memory_reads++;                                    \
+  }while( 0 )
+#define LD_ADDR  ( ( ( m->reg[ di->s1 ] + m->reg[ di->s2 ] ) << 16 ) >> 16 )
+#define LDI_ADDR ( (short)( di->imm + m->reg[ di->s2 ] ) )
+
+#define ADDS() do{                                        \
+    addr = m->reg[ di->s2 ];                              \
+    m->reg[ di->d ] = m->reg[ di->s1 ] + addr;            \
+    m->cc_bit = ( addr < ( ~m->reg[ di->s1 ] + 1 ) ) ? 1 : 0; \
+  }while( 0 )
+#define ADDSI() do{                                       \
+    m->reg[ di->d ] = m->reg[ di->s2 ] + di->imm;         \
+    m->cc_bit = ( m->reg[ di->s2 ] < -di->imm ) ? 1 : 0;  \
+  }while( 0 )
+#define SUBS() do{                                        \
+    m->reg[ di->d ] = m->reg[ di->s1 ] - m->reg[ di->s2 ];\
+    m->cc_bit = ( m->reg[ di->s2 ] > m->reg[ di->s1 ] ) ? 1 : 0; \
+  }while( 0 )
+
+  DISPATCH();
+
+  /* choose the label for a record that has none, fusing it with the
+     next word on the page if the two form a pair; decoding that word
+     clears this record's label, so it is set afterwards */
+retarget:
+  if( ( m->fip & ( ( PAGE_WORDS - 1 ) << 2 ) ) != ( ( PAGE_WORDS - 1 ) << 2 ) ){
+    if( !di[ 1 ].valid ) predecode( m, m->fip + 4 );
+    switch( ( di->op1 << 6 ) | di[ 1 ].op1 ){
+      case ( 0x25 << 6 ) | 0x14: di->target = &&fuse_addsi_btne;  break;
+      case ( 0x25 << 6 ) | 0x15: di->target = &&fuse_addsi_btnei; break;
+      case ( 0x24 << 6 ) | 0x1c: di->target = &&fuse_adds_bc;     break;
+      case ( 0x24 << 6 ) | 0x1e: di->target = &&fuse_adds_bnc;    break;
+      case ( 0x25 << 6 ) | 0x1c: di->target = &&fuse_addsi_bc;    break;
+      case ( 0x25 << 6 ) | 0x1e: di->target = &&fuse_addsi_bnc;   break;
+      case ( 0x26 << 6 ) | 0x1c: di->target = &&fuse_subs_bc;     break;
+      case ( 0x26 << 6 ) | 0x1e: di->target = &&fuse_subs_bnc;    break;
+      case ( 0x04 << 6 ) | 0x04: di->target = &&fuse_ld_ld;       break;
+      case ( 0x04 << 6 ) | 0x05: di->target = &&fuse_ld_ldi;      break;
+      case ( 0x05 << 6 ) | 0x04: di->target = &&fuse_ldi_ld;      break;
+      case ( 0x05 << 6 ) | 0x05: di->target = &&fuse_ldi_ldi;     break;
+    }
+  }
+  if( !di->target ) di->target = labels[ di->op1 ] ? labels[ di->op1 ] : &&op_call;
+  m->xip = m->fip;
+  m->fip = m->xip + 4;
+  m->inst_fetches++;
+  goto *di->target;
+
+fuse_addsi_btne:  FUSED( op_addsi ); ADDSI(); NEXT_IN_PAIR(); goto op_btne;
+fuse_addsi_btnei: FUSED( op_addsi ); ADDSI(); NEXT_IN_PAIR(); goto op_btnei;
+fuse_adds_bc:     FUSED( op_adds );  ADDS();  NEXT_IN_PAIR(); goto op_bc;
+fuse_adds_bnc:    FUSED( op_adds );  ADDS();  NEXT_IN_PAIR(); goto op_bnc;
+fuse_addsi_bc:    FUSED( op_addsi ); ADDSI(); NEXT_IN_PAIR(); goto op_bc;
+fuse_addsi_bnc:   FUSED( op_addsi ); ADDSI(); NEXT_IN_PAIR(); goto op_bnc;
+fuse_subs_bc:     FUSED( op_subs );  SUBS();  NEXT_IN_PAIR(); goto op_bc;
+fuse_subs_bnc:    FUSED( op_subs );  SUBS();  NEXT_IN_PAIR(); goto op_bnc;
+fuse_ld_ld:       FUSED( op_ld );  LOAD( LD_ADDR );  NEXT_IN_PAIR(); goto op_ld;
+fuse_ld_ldi:      FUSED( op_ld );  LOAD( LD_ADDR );  NEXT_IN_PAIR(); goto op_ldi;
+fuse_ldi_ld:      FUSED( op_ldi ); LOAD( LDI_ADDR ); NEXT_IN_PAIR(); goto op_ld;
+fuse_ldi_ldi:     FUSED( op_ldi ); LOAD( LDI_ADDR ); NEXT_IN_PAIR(); goto op_ldi;
+
+op_halt:
+  m->halt_flag = 1;
+  m->reg[ 0 ] = 0;
+  return;
+
+zero_branch:
+  zero_displacement( m );
+  m->reg[ 0 ] = 0;
+  return;
+
+op_ld:
+  LOAD( LD_ADDR );
+  DISPATCH();
+
+op_ldi:
+  LOAD( LDI_ADDR );
+  DISPATCH();
+
+op_st:
+  addr = (short)( di->imm + m->reg[ di->s2 ] );
+  cache_access( &m->cache, addr, 1 );
+  page = mem_page( m, addr );
+  page->word[ ( addr >> 2 ) & ( PAGE_WORDS - 1 ) ] = m->reg[ di->s1 ];
+  page->dirty = 1;
+  if( page->decoded ) page->decoded[ ( addr >> 2 ) & ( PAGE_WORDS - 1 ) ].valid = 0;
+  m->memory_writes++;
+  DISPATCH();
+
+op_btne:
+  m->branches++;
+  if( m->reg[ di->s1 ] != m->reg[ di->s2 ] ){
+    m->fip += di->imm << 2;
+    m->taken++;
+  }
+  DISPATCH();
+
+op_btnei:
+  if( !di->imm ) goto zero_branch;
+  m->branches++;
+  if( di->s1 != m->reg[ di->s2 ] ){
+    m->fip += di->imm << 2;
+    m->taken++;
+  }
+  DISPATCH();
+
+op_bte:
+  if( !di->imm ) goto zero_branch;
+  m->branches++;
+  if( m->reg[ di->s1 ] == m->reg[ di->s2 ] ){
+    m->fip += di->imm << 2;
+    m->taken++;
+  }
+  DISPATCH();
+
+op_btei:
+  if( !di->imm ) goto zero_branch;
+  m->branches++;
+  if( di->s1 == m->reg[ di->s2 ] ){
+    m->fip += di->imm << 2;
+    m->taken++;
+  }
+  DISPATCH();
+
+op_br:
+  if( !di->imm ) goto zero_branch;
+  m->fip += di->imm << 2;
+  m->branches++;
+  m->taken++;
+  DISPATCH();
+
+op_bc:
+  if( m->cc_bit == 1 ){
+    if( !di->imm ) goto zero_branch;
+    m->fip += di->imm << 2;
+    m->taken++;
+  }
+  m->branches++;
+  DISPATCH();
+
+op_bnc:
+  if( m->cc_bit == 0 ){
+    if( !di->imm ) goto zero_branch;
+    m->fip += di->imm << 2;
+    m->taken++;
+  }
+  m->branches++;
+  DISPATCH();
+
+op_adds:
+  ADDS();
+  DISPATCH();
+
+op_addsi:
+  ADDSI();
+  DISPATCH();
+
+op_subs:
+  SUBS();
+  DISPATCH();
+
+op_shl:
+  m->reg[ di->d ] = m->reg[ di->s2 ] << m->reg[ di->s1 ];
+  DISPATCH();
+
+op_shli:
+  m->reg[ di->d ] = m->reg[ di->s2 ] << di->genset;
+  DISPATCH();
+
+op_shri:
+op_shrai:
+  m->reg[ di->d ] = m->reg[ di->s2 ] >> di->genset;
+  DISPATCH();
+
+op_shra:
+  m->reg[ di->d ] = m->reg[ di->s2 ] >> m->reg[ di->s1 ];
+  DISPATCH();
+
+op_call:
+  m->ir     = di->ir;
+  m->op1    = di->op1;
+  m->d      = di->d;
+  m->s1     = di->s1;
+  m->s2     = di->s2;
+  m->genset = di->genset;
+  di->handler( m );
+  if( m->halt_flag ){
+    m->reg[ 0 ] = 0;
+    return;
+  }
+  DISPATCH();
+
+#undef DISPATCH
+#undef FUSED
+#undef NEXT_IN_PAIR
+#undef LOAD
+#undef LD_ADDR
+#undef LDI_ADDR
+#undef ADDS
+#undef ADDSI
+#undef SUBS
+}
+
+/* tiered JIT: blocks are interpreted with the normal handlers until
+   their entry address has been dispatched JIT_THRESHOLD times, then the
+   block up to and including its terminating branch is translated into
+   x86-64 code that works on reg[], cc_bit and the statistics counters
+   directly; loads, stores and opcodes that print call back into the
+   handlers.  Block exits are patched to jump straight into their target
+   once it is translated.  A store into a translated word requests a
+   flush of the whole code buffer, done on the next return to run_jit() */
+
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD  50
+#endif
+#define JIT_MAX_BLOCK  64
+#define JIT_MAX_BLOCKS ( 64 * 1024 )
+#define JIT_CODE_SIZE  ( 16 * 1024 * 1024 )
+#define JIT_MAX_EXITS  ( 64 * 1024 )
+
+struct jit_block {
+  unsigned char *entry, /* prologue, called from run_jit()        */
+                *body;  /* first instruction, target of chaining  */
+};
+
+struct jit_exit {
+  int pc;               /* guest address the exit leaves for      */
+  unsigned char *patch; /* rel32 of the exit's jmp                */
+};
+
+/* per-page translation state, hung off the guest page */
+struct jit_page {
+  struct jit_block *map[PAGE_WORDS];            /* block starting at word        */
+  unsigned short count[PAGE_WORDS];             /* dispatches of word            */
+  unsigned char covered[PAGE_WORDS];            /* word is in a translated block */
+};
+
+struct jit {
+  struct machine *m;                            /* owner, whose pages hold maps  */
+  struct jit_block blocks[JIT_MAX_BLOCKS];
+  struct jit_exit exits[JIT_MAX_EXITS];         /* exits not yet chained         */
+  unsigned char *code, *ptr;                    /* code buffer                   */
+  int num_blocks,
+      num_exits,
+      flush_pending;                            /* a store hit translated code   */
+};
+
+void jit_reset( struct jit *j ){
+  for( struct page *p = j->m->pages; p; p = p->next ){
+    free( p->jit );
+    p->jit = NULL;
+  }
+  j->ptr = j->code;
+  j->num_blocks = j->num_exits = j->flush_pending = 0;
+}
+
+struct jit_page *jit_page_at( struct machine *m, unsigned int addr ){
+  struct page *p = mem_page( m, addr );
+  if( !p->jit ){
+    p->jit = calloc( 1, sizeof( struct jit_page ) );
+    if( !p->jit ) out_of_memory();
+  }
+  return p->jit;
+}
+
+/* the block starting at addr, without allocating map space */
+struct jit_block *jit_block_at( struct machine *m, unsigned int addr ){
+  struct page *p = mem_page( m, addr );
+  return p->jit ? p->jit->map[ ( addr >> 2 ) & ( PAGE_WORDS - 1 ) ] : NULL;
+}
+
+void jit_note_store( struct machine *m, unsigned int addr ){
+  struct page *p = mem_page( m, addr );
+  if( p->jit && p->jit->covered[ ( addr >> 2 ) & ( PAGE_WORDS - 1 ) ] ) m->jit->flush_pending = 1;
+}
+
+int jit_is_branch( int op ){
+  return ( ( op >= 0x14 ) && ( op <= 0x17 ) ) || ( op == 0x1a ) || ( op == 0x1c ) || ( op == 0x1e );
+}
+
+#if defined( __x86_64__ )
+
+/* native code keeps the machine pointer in rbx, so every field is at a
+   fixed displacement from it */
+#define M_OFF( field ) ( (int)offsetof( struct machine, field ) )
+#define REG_OFF( r )   ( M_OFF( reg ) + 4 * ( r ) )
+
+void emit1( struct jit *j, int b ){ *j->ptr++ = b; }
+
+void emit4( struct jit *j, int v ){ memcpy( j->ptr, &v, 4 ); j->ptr += 4; }
+
+void emit8( struct jit *j, void *p ){ memcpy( j->ptr, &p, 8 ); j->ptr += 8; }
+
+/* mov r32,[rbx+off] and mov [rbx+off],r32 for eax (0), ecx (1) */
+void emit_load( struct jit *j, int r, int off ){ emit1( j, 0x8b ); emit1( j, 0x83 | ( r << 3 ) ); emit4( j, off ); }
+void emit_store( struct jit *j, int r, int off ){ emit1( j, 0x89 ); emit1( j, 0x83 | ( r << 3 ) ); emit4( j, off ); }
+
+/* add/sub dword [rbx+off],imm32 and mov dword [rbx+off],imm32 */
+void emit_add_mem( struct jit *j, int off, int n ){ emit1( j, 0x81 ); emit1( j, 0x83 ); emit4( j, off ); emit4( j, n ); }
+void emit_sub_mem( struct jit *j, int off, int n ){ emit1( j, 0x81 ); emit1( j, 0xab ); emit4( j, off ); emit4( j, n ); }
+void emit_set_mem( struct jit *j, int off, int n ){ emit1( j, 0xc7 ); emit1( j, 0x83 ); emit4( j, off ); emit4( j, n ); }
+
+/* setcc al; movzx eax,al; mov [cc_bit],eax */
+void emit_set_cc( struct jit *j, int setcc ){
+  emit1( j, 0x0f ); emit1( j, setcc ); emit1( j, 0xc0 );
+  emit1( j, 0x0f ); emit1( j, 0xb6 ); emit1( j, 0xc0 );
+  emit_store( j, 0, M_OFF( cc_bit ) );
+}
+
+/* r0 reads as the value just written until the end of the instruction */
+void emit_clear_r0( struct jit *j, int dest ){
+  if( dest == 0 ) emit_set_mem( j, REG_OFF( 0 ), 0 );
+}
+
+/* leave for pc through a jmp that chaining can later redirect */
+void emit_exit( struct jit *j, int pc ){
+  emit1( j, 0xe9 );
+  unsigned char *patch = j->ptr;
+  emit4( j, 0 );
+  emit1( j, 0xb8 ); emit4( j, pc );                  /* mov eax,pc */
+  emit1( j, 0x5b );                                  /* pop rbx    */
+  emit1( j, 0xc3 );                                  /* ret        */
+
+  struct jit_block *target = jit_block_at( j->m, pc );
+  if( target ){
+    int rel = target->body - ( patch + 4 );
+    memcpy( patch, &rel, 4 );
+  }else if( j->num_exits < JIT_MAX_EXITS ){
+    j->exits[ j->num_exits ].pc = pc;
+    j->exits[ j->num_exits ].patch = patch;
+    j->num_exits++;
+  }
+}
+
+/* run one instruction through its handler on behalf of native code and
+   report whether a store hit translated code */
+int jit_helper( struct machine *m, struct decoded *di ){
+  m->ir     = di->ir;
+  m->op1    = di->op1;
+  m->d      = di->d;
+  m->s1     = di->s1;
+  m->s2     = di->s2;
+  m->genset = di->genset;
+  di->handler( m );
+  m->reg[ 0 ] = 0;
+  return m->jit->flush_pending;
+}
+
+void emit_helper( struct jit *j, struct decoded *di ){
+  emit1( j, 0x48 ); emit1( j, 0x89 ); emit1( j, 0xdf );     /* mov rdi,rbx */
+  emit1( j, 0x48 ); emit1( j, 0xbe ); emit8( j, di );       /* mov rsi,di  */
+  emit1( j, 0x48 ); emit1( j, 0xb8 ); emit8( j, jit_helper ); /* mov rax,fn */
+  emit1( j, 0xff ); emit1( j, 0xd0 );                       /* call rax    */
+}
+
+/* branches whose handler rejects a zero displacement are left to the
+   interpreter in that case, as is halt */
+int jit_translatable( struct machine *m, int pc ){
+  struct decoded *di = decoded_at( m, pc );
+  if( !di->valid ) predecode( m, pc );
+  if( di->op1 == 0x00 ) return 0;
+  if( jit_is_branch( di->op1 ) && ( di->op1 != 0x14 ) && ( di->imm == 0 ) ) return 0;
+  return 1;
+}
+
+void jit_emit_branch( struct jit *j, struct decoded *di, int next ){
+  int target = next + ( di->imm << 2 ), jcc;
+  unsigned char *fixup = NULL;
+
+  emit_add_mem( j, M_OFF( branches ), 1 );
+  switch( di->op1 ){
+    case 0x14:                                           /* btne  */
+    case 0x16:                                           /* bte   */
+      emit_load( j, 0, REG_OFF( di->s1 ) );
+      emit_load( j, 1, REG_OFF( di->s2 ) );
+      emit1( j, 0x39 ); emit1( j, 0xc8 );                /* cmp eax,ecx */
+      jcc = ( di->op1 == 0x14 ) ? 0x85 : 0x84;
+      break;
+    case 0x15:                                           /* btnei */
+    case 0x17:                                           /* btei  */
+      emit_load( j, 0, REG_OFF( di->s2 ) );
+      emit1( j, 0x3d ); emit4( j, di->s1 );              /* cmp eax,imm */
+      jcc = ( di->op1 == 0x15 ) ? 0x85 : 0x84;
+      break;
+    case 0x1c:                                           /* bc    */
+    case 0x1e:                                           /* bnc   */
+      emit_load( j, 0, M_OFF( cc_bit ) );
+      emit1( j, 0x3d ); emit4( j, di->op1 == 0x1c ? 1 : 0 );
+      jcc = 0x84;
+      break;
+    default:                                             /* br    */
+      jcc = 0;
+  }
+  if( jcc ){
+    emit1( j, 0x0f ); emit1( j, jcc );
+    fixup = j->ptr;
+    emit4( j, 0 );
+    emit_exit( j, next );
+    int rel = j->ptr - ( fixup + 4 );
+    memcpy( fixup, &rel, 4 );
+  }
+  emit_add_mem( j, M_OFF( taken ), 1 );
+  emit_exit( j, target );
+}
+
+/* translate the block at pc; returns NULL if its first instruction has
+   to be interpreted */
+struct jit_block *jit_translate( struct machine *m, int pc ){
+  struct jit *j = m->jit;
+  int n = 0, start = pc;
+
+  if( ( j->ptr + JIT_MAX_BLOCK * 64 + 256 > j->code + JIT_CODE_SIZE ) ||
+      ( j->num_blocks == JIT_MAX_BLOCKS ) ) jit_reset( j );
+
+  while( ( n < JIT_MAX_BLOCK ) && jit_translatable( m, pc + 4 * n ) ){
+    n++;
+    if( jit_is_branch( decoded_at( m, pc + 4 * ( n - 1 ) )->op1 ) ) break;
+  }
+  if( n == 0 ) return NULL;
+
+  struct jit_block *b = &j->blocks[ j->num_blocks++ ];
+  b->entry = j->ptr;
+  emit1( j, 0x53 );                                      /* push rbx    */
+  emit1( j, 0x48 ); emit1( j, 0x89 ); emit1( j, 0xfb );  /* mov rbx,rdi */
+  b->body = j->ptr;
+  emit_add_mem( j, M_OFF( inst_fetches ), n );
+
+  for( int i = 0; i < n; i++, pc += 4 ){
+    struct decoded *di = decoded_at( m, pc );
+    jit_page_at( m, pc )->covered[ ( pc >> 2 ) & ( PAGE_WORDS - 1 ) ] = 1;
+
+    switch( di->op1 ){
+      case 0x24:                                         /* adds  */
+        emit_load( j, 1, REG_OFF( di->s2 ) );
+        emit_load( j, 0, REG_OFF( di->s1 ) );
+        emit1( j, 0x01 ); emit1( j, 0xc8 );              /* add eax,ecx */
+        emit_store( j, 0, REG_OFF( di->d ) );
+        emit_load( j, 0, REG_OFF( di->s1 ) );
+        emit1( j, 0xf7 ); emit1( j, 0xd8 );              /* neg eax     */
+        emit1( j, 0x39 ); emit1( j, 0xc1 );              /* cmp ecx,eax */
+        emit_set_cc( j, 0x9c );                          /* setl        */
+        emit_clear_r0( j, di->d );
+        break;
+      case 0x25:                                         /* adds imm */
+        emit_load( j, 0, REG_OFF( di->s2 ) );
+        emit1( j, 0x05 ); emit4( j, di->imm );           /* add eax,imm */
+        emit_store( j, 0, REG_OFF( di->d ) );
+        emit_load( j, 0, REG_OFF( di->s2 ) );
+        emit1( j, 0x3d ); emit4( j, -di->imm );          /* cmp eax,imm */
+        emit_set_cc( j, 0x9c );
+        emit_clear_r0( j, di->d );
+        break;
+      case 0x26:                                         /* subs  */
+        emit_load( j, 0, REG_OFF( di->s1 ) );
+        emit_load( j, 1, REG_OFF( di->s2 ) );
+        emit1( j, 0x29 ); emit1( j, 0xc8 );              /* sub eax,ecx */
+        emit_store( j, 0, REG_OFF( di->d ) );
+        emit_load( j, 0, REG_OFF( di->s2 ) );
+        emit_load( j, 1, REG_OFF( di->s1 ) );
+        emit1( j, 0x39 ); emit1( j, 0xc8 );              /* cmp eax,ecx */
+        emit_set_cc( j, 0x9f );                          /* setg        */
+        emit_clear_r0( j, di->d );
+        break;
+      case 0x28:                                         /* shl   */
+      case 0x2e:                                         /* shra  */
+        emit_load( j, 0, REG_OFF( di->s2 ) );
+        emit_load( j, 1, REG_OFF( di->s1 ) );
+        emit1( j, 0xd3 ); emit1( j, di->op1 == 0x28 ? 0xe0 : 0xf8 );
+        emit_store( j, 0, REG_OFF( di->d ) );
+        emit_clear_r0( j, di->d );
+        break;
+      case 0x29:                                         /* shli  */
+      case 0x2b:                                         /* shri  */
+      case 0x2f:                                         /* shrai */
+        emit_load( j, 0, REG_OFF( di->s2 ) );
+        emit1( j, 0xc1 ); emit1( j, di->op1 == 0x29 ? 0xe0 : 0xf8 ); emit1( j, di->genset & 0x1f );
+        emit_store( j, 0, REG_OFF( di->d ) );
+        emit_clear_r0( j, di->d );
+        break;
+      default:
+        if( jit_is_branch( di->op1 ) ){
+          jit_emit_branch( j, di, pc + 4 );
+          break;
+        }
+        emit_helper( j, di );
+        if( di->op1 == 0x07 ){                           /* st.l may hit code */
+          emit1( j, 0x85 ); emit1( j, 0xc0 );            /* test eax,eax */
+          emit1( j, 0x74 ); emit1( j, 0x11 );            /* jz over exit */
+          emit_sub_mem( j, M_OFF( inst_fetches ), n - i - 1 ); /* 10 bytes */
+          emit1( j, 0xb8 ); emit4( j, pc + 4 );          /* 5 bytes      */
+          emit1( j, 0x5b );
+          emit1( j, 0xc3 );
+        }
+    }
+  }
+  if( !jit_is_branch( decoded_at( m, pc - 4 )->op1 ) ) emit_exit( j, pc );
+
+  /* chain exits of earlier blocks that were waiting for this one */
+  jit_page_at( m, start )->map[ ( start >> 2 ) & ( PAGE_WORDS - 1 ) ] = b;
+  for( int i = 0; i < j->num_exits; i++ ){
+    if( j->exits[ i ].pc == start ){
+      int rel = b->body - ( j->exits[ i ].patch + 4 );
+      memcpy( j->exits[ i ].patch, &rel, 4 );
+      j->exits[ i-- ] = j->exits[ --j->num_exits ];
+    }
+  }
+  return b;
+}
+
+int jit_init( struct machine *m ){
+  struct jit *j = calloc( 1, sizeof( *j ) );
+  if( !j ) return 0;
+  j->m = m;
+  j->code = mmap( NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if( j->code == MAP_FAILED ){
+    free( j );
+    return 0;
+  }
+  jit_reset( j );
+  m->jit = j;
+  return 1;
+}
+
+void jit_free( struct jit *j ){
+  munmap( j->code, JIT_CODE_SIZE );
+  free( j );
+}
+
+#else
+
+int jit_init( struct machine *m ){ (void)m; return 0; }
+
+void jit_free( struct jit *j ){ free( j ); }
+
+struct jit_block *jit_translate( struct machine *m, int pc ){ (void)m; (void)pc; return NULL; }
+
+#endif
+
+/* JIT engine: dispatch to native blocks where they exist, otherwise
+   interpret one basic block with the handlers and count its entry */
+void run_jit( struct machine *m ){
+  if( !m->jit && !jit_init( m ) ){
+    fprintf( m->out, "JIT not available, using the threaded engine\n" );
+    run_threaded( m );
+    return;
+  }
+
+  struct jit *j = m->jit;
+  while( !m->halt_flag ){
+    if( j->flush_pending ) jit_reset( j );
+
+    struct jit_page *jp = jit_page_at( m, m->fip );
+    int w = ( m->fip >> 2 ) & ( PAGE_WORDS - 1 );
+    struct jit_block *b = jp->map[ w ];
+    if( !b && ( ++jp->count[ w ] == JIT_THRESHOLD ) ) b = jit_translate( m, m->fip );
+    if( b ){
+      m->fip = ( (int (*)( struct machine * ))b->entry )( m );
+      continue;
+    }
+
+    do{
+      step( m );
+    }while( !m->halt_flag && ( m->fip == m->xip + 4 ) && !jit_is_branch( m->op1 ) );
+  }
+}
+
+/* ahead-of-time translation: write the loaded program as C with one
+   label per instruction and the handler body inlined at each, to be
+   compiled against this file with SIM_NO_MAIN defined.  Branch targets
+   inside the program become gotos; anything else (targets outside it,
+   branches with a zero displacement, a store into the program's words)
+   leaves for the interpreter through the dispatch loop.  Only the
+   segment holding the entry point is translated */
+
+/* the loaded segment containing the entry point */
+struct segment *code_segment( struct machine *m ){
+  for( int i = 0; i < m->image.num_segments; i++ ){
+    struct segment *s = &m->image.segments[ i ];
+    if( ( m->image.entry >= s->addr ) && ( m->image.entry < s->addr + 4 * s->words ) ) return s;
+  }
+  return NULL;
+}
+
+void translate_inst( struct machine *m, FILE *out, int pc, struct decoded *di ){
+  struct segment *code = code_segment( m );
+  int next = pc + 4, target = next + ( di->imm << 2 );
+  int in_range = ( target >= code->addr ) && ( target < code->addr + 4 * code->words );
+
+  fprintf( out, "i_%04x: /* %08x */\n", pc, di->ir );
+  fprintf( out, "  m->inst_fetches++;\n" );
+  switch( di->op1 ){
+    case 0x00:
+      fprintf( out, "  m->halt_flag = 1;\n  m->reg[ 0 ] = 0;\n  return;\n" );
+      return;
+    case 0x04:
+      fprintf( out, "  addr = ( ( m->reg[ %d ] + m->reg[ %d ] ) << 16 ) >> 16;\n", di->s1, di->s2 );
+      fprintf( out, "  LOAD( addr, %d );\n", di->d );
+      break;
+    case 0x05:
+      fprintf( out, "  addr = (short)( %d + m->reg[ %d ] );\n", di->imm, di->s2 );
+      fprintf( out, "  LOAD( addr, %d );\n", di->d );
+      break;
+    case 0x07:
+      fprintf( out, "  addr = (short)( %d + m->reg[ %d ] );\n", di->imm, di->s2 );
+      fprintf( out, "  STORE( addr, %d, 0x%x );\n", di->s1, next );
+      break;
+    case 0x14:
+    case 0x15:
+    case 0x16:
+    case 0x17:
+    case 0x1a:
+    case 0x1c:
+    case 0x1e:
+      if( ( di->imm == 0 ) && ( di->op1 != 0x14 ) ){
+        fprintf( out, "  m->inst_fetches--;\n  m->fip = 0x%x;\n  goto dispatch;\n", pc );
+        return;
+      }
+      fprintf( out, "  m->branches++;\n" );
+      switch( di->op1 ){
+        case 0x14: fprintf( out, "  if( m->reg[ %d ] != m->reg[ %d ] ){\n", di->s1, di->s2 ); break;
+        case 0x15: fprintf( out, "  if( %d != m->reg[ %d ] ){\n", di->s1, di->s2 ); break;
+        case 0x16: fprintf( out, "  if( m->reg[ %d ] == m->reg[ %d ] ){\n", di->s1, di->s2 ); break;
+        case 0x17: fprintf( out, "  if( %d == m->reg[ %d ] ){\n", di->s1, di->s2 ); break;
+        case 0x1a: fprintf( out, "  {\n" ); break;
+        case 0x1c: fprintf( out, "  if( m->cc_bit == 1 ){\n" ); break;
+        case 0x1e: fprintf( out, "  if( m->cc_bit == 0 ){\n" ); break;
+      }
+      fprintf( out, "    m->taken++;\n" );
+      if( in_range ){
+        fprintf( out, "    goto i_%04x;\n  }\n", target );
+      }else{
+        fprintf( out, "    m->fip = 0x%x;\n    goto dispatch;\n  }\n", target );
+      }
+      return;
+    case 0x24:
+      fprintf( out, "  addr = m->reg[ %d ];\n", di->s2 );
+      fprintf( out, "  m->reg[ %d ] = m->reg[ %d ] + addr;\n", di->d, di->s1 );
+      fprintf( out, "  m->cc_bit = ( addr < ( ~m->reg[ %d ] + 1 ) ) ? 1 : 0;\n", di->s1 );
+      break;
+    case 0x25:
+      fprintf( out, "  m->reg[ %d ] = m->reg[ %d ] + %d;\n", di->d, di->s2, di->imm );
+      fprintf( out, "  m->cc_bit = ( m->reg[ %d ] < %d ) ? 1 : 0;\n", di->s2, -di->imm );
+      break;
+    case 0x26:
+      fprintf( out, "  m->reg[ %d ] = m->reg[ %d ] - m->reg[ %d ];\n", di->d, di->s1, di->s2 );
+      fprintf( out, "  m->cc_bit = ( m->reg[ %d ] > m->reg[ %d ] ) ? 1 : 0;\n", di->s2, di->s1 );
+      break;
+    case 0x28:
+      fprintf( out, "  m->reg[ %d ] = m->reg[ %d ] << m->reg[ %d ];\n", di->d, di->s2, di->s1 );
+      break;
+    case 0x29:
+      fprintf( out, "  m->reg[ %d ] = m->reg[ %d ] << %d;\n", di->d, di->s2, di->genset & 0x1f );
+      break;
+    case 0x2b:
+    case 0x2f:
+      fprintf( out, "  m->reg[ %d ] = m->reg[ %d ] >> %d;\n", di->d, di->s2, di->genset & 0x1f );
+      break;
+    case 0x2e:
+      fprintf( out, "  m->reg[ %d ] = m->reg[ %d ] >> m->reg[ %d ];\n", di->d, di->s2, di->s1 );
+      break;
+    default:
+      /* subs immediate and shr print even when not tracing, and unknown
+         opcodes are ignored, so let their handlers run */
+      fprintf( out, "  m->inst_fetches--;\n  m->fip = 0x%x;\n  step( m );\n", pc );
+      break;
+  }
+  fprintf( out, "  m->reg[ 0 ] = 0;\n" );
+}
+
+void translate_program( struct machine *m, FILE *out ){
+  struct segment *code = code_segment( m );
+  int base = code ? code->addr : 0, words = code ? code->words : 0;
+
+  fprintf( out, "/* i860 program translated by sim -x; build with\n" );
+  fprintf( out, "   gcc -O2 -pthread -I<directory of sim.c> <this file> -lm */\n\n" );
+  fprintf( out, "#define SIM_NO_MAIN\n#include \"sim.c\"\n\n" );
+
+  for( int i = 0; i < m->image.num_segments; i++ ){
+    struct segment *s = &m->image.segments[ i ];
+    fprintf( out, "int segment%d[%d] = {", i, s->words + 1 );
+    for( int j = 0; j < s->words; j++ ){
+      fprintf( out, "%s0x%08x,", ( j % 6 ) ? " " : "\n  ", s->data[ j ] );
+    }
+    fprintf( out, "\n};\n\n" );
+  }
+  fprintf( out, "struct segment segments[%d] = {\n", m->image.num_segments + 1 );
+  for( int i = 0; i < m->image.num_segments; i++ ){
+    struct segment *s = &m->image.segments[ i ];
+    fprintf( out, "  { 0x%x, %d, %d, segment%d },\n", s->addr, s->words, s->fill, i );
+  }
+  fprintf( out, "};\n\n" );
+
+  fprintf( out, "#define LOAD( a, r ) do{ \\\n" );
+  fprintf( out, "    cache_access( &m->cache, a, 0 ); \\\n" );
+  fprintf( out, "    m->reg[ r ] = *mem_word( m, a ); \\\n" );
+  fprintf( out, "    m->memory_reads++; \\\n" );
+  fprintf( out, "  }while( 0 )\n\n" );
+  fprintf( out, "/* a store into the translated words ends translated execution */\n" );
+  fprintf( out, "#define STORE( a, r, next ) do{ \\\n" );
+  fprintf( out, "    cache_access( &m->cache, a, 1 ); \\\n" );
+  fprintf( out, "    struct page *p = mem_page( m, a ); \\\n" );
+  fprintf( out, "    p->word[ ( a >> 2 ) & ( PAGE_WORDS - 1 ) ] = m->reg[ r ]; \\\n" );
+  fprintf( out, "    p->dirty = 1; \\\n" );
+  fprintf( out, "    if( p->decoded ) p->decoded[ ( a >> 2 ) & ( PAGE_WORDS - 1 ) ].valid = 0; \\\n" );
+  fprintf( out, "    m->memory_writes++; \\\n" );
+  fprintf( out, "    if( ( a >= 0x%x ) && ( a < 0x%x ) ){ \\\n", base, base + 4 * words );
+  fprintf( out, "      modified = 1; \\\n" );
+  fprintf( out, "      m->reg[ 0 ] = 0; \\\n" );
+  fprintf( out, "      m->fip = next; \\\n" );
+  fprintf( out, "      goto dispatch; \\\n" );
+  fprintf( out, "    } \\\n" );
+  fprintf( out, "  }while( 0 )\n\n" );
+
+  fprintf( out, "void run_translated( struct machine *m ){\n" );
+  fprintf( out, "  static void *labels[%d] = {", words + 1 );
+  for( int i = 0; i < words; i++ ){
+    fprintf( out, "%s&&i_%04x,", ( i % 6 ) ? " " : "\n    ", base + 4 * i );
+  }
+  fprintf( out, "\n  };\n" );
+  fprintf( out, "  int addr, modified = 0;\n  (void)addr;\n\n" );
+  fprintf( out, "dispatch:\n" );
+  fprintf( out, "  while( !m->halt_flag ){\n" );
+  fprintf( out, "    if( !modified && ( m->fip >= 0x%x ) && ( m->fip < 0x%x ) ) goto *labels[ ( m->fip - 0x%x ) >> 2 ];\n",
+    base, base + 4 * words, base );
+  fprintf( out, "    step( m );\n" );
+  fprintf( out, "  }\n" );
+  fprintf( out, "  return;\n\n" );
+
+  for( int i = 0; i < words; i++ ){
+    struct decoded *di = decoded_at( m, base + 4 * i );
+    if( !di->valid ) predecode( m, base + 4 * i );
+    translate_inst( m, out, base + 4 * i, di );
+  }
+  fprintf( out, "  m->fip = 0x%x;\n  goto dispatch;\n}\n\n", base + 4 * words );
+
+  fprintf( out, "int main(){\n" );
+  fprintf( out, "  struct machine *m = machine_create( stdout );\n" );
+  fprintf( out, "  cache_configure( &m->cache, %u, %u, %u );\n", m->cache.sets, m->cache.ways, m->cache.line_size );
+  fprintf( out, "  m->cache.policy = %u;\n", m->cache.policy );
+  fprintf( out, "  m->image.entry = 0x%x;\n", m->image.entry );
+  fprintf( out, "  m->image.num_segments = %d;\n", m->image.num_segments );
+  fprintf( out, "  m->image.segments = segments;\n" );
+  fprintf( out, "  install_image( m );\n" );
+  fprintf( out, "  run_translated( m );\n" );
+  fprintf( out, "  print_stats( m );\n" );
+  fprintf( out, "  return 0;\n" );
+  fprintf( out, "}\n" );
+}
+
+void print_stats( struct machine *m ){
+  fprintf( m->out, "execution statistics (in decimal):\n" );
+  fprintf( m->out, "  instruction fetches = %d\n", m->inst_fetches );
+  fprintf( m->out, "  data words read     = %d\n", m->memory_reads );
+  fprintf( m->out, "  data words written  = %d\n", m->memory_writes );
+  fprintf( m->out, "  branches executed   = %d\n", m->branches );
+  if( m->taken == 0 ){
+    fprintf( m->out, "  branches taken      = 0\n" );
+  }else{
+    fprintf( m->out, "  branches taken      = %d (%.1f%%)\n",
+      m->taken, 100.0*((float)m->taken)/((float)m->branches) );
+  }
+  cache_stats( &m->cache, m->out );
+}
+
+/* put the machine back in its post-load state so the program can be
+   run again */
+void reset_machine( struct machine *m ){
+  for( int i = 0; i < 32; i++ ) m->reg[ i ] = 0;
+  m->xip = m->fip = m->halt_flag = m->cc_bit = 0;
+  m->inst_fetches = m->memory_reads = m->memory_writes = m->branches = m->taken = 0;
+  if( m->jit ) jit_reset( m->jit );
+  profile_free( m );
+  predictors_free( m );
+  timing_free( m );
+  ilp_free( m );
+  mrc_free( m );
+  policies_free( m );
+  hierarchy_free( m );
+  mem_free( m );
+  install_image( m );
+  cache_init( &m->cache );
+}
+
+void machine_free( struct machine *m ){
+  if( m->jit ) jit_free( m->jit );
+  profile_free( m );
+  predictors_free( m );
+  timing_free( m );
+  ilp_free( m );
+  mrc_free( m );
+  policies_free( m );
+  hierarchy_free( m );
+  cache_free( &m->cache );
+  for( int i = 0; i < m->image.num_segments; i++ ) free( m->image.segments[ i ].data );
+  free( m->image.segments );
+  mem_free( m );
+  free( m );
+}
+
+/* multi-core simulation: -N n runs n cores over the loaded program in
+   one shared memory.  Each core is a machine of its own, with its own
+   registers, counters, TLB and copy of the data cache, but its pages
+   belong to the machine that loaded the program.  Every core starts at
+   the entry point with its number in r31 and the number of cores in
+   r30, so one program can split its work by core, or branch to a
+   different routine on each.
+
+   The caches are kept coherent with MESI.  A line is modified when it
+   is dirty, and a clean line is shared or exclusive by the coherence
+   shared bit.  A data access holds the bus lock while it snoops the
+   other caches, so the accesses of all cores happen one at a time, as
+   on a snooping bus.
+
+   The cores run on threads of their own, a quantum of instructions at
+   a time, and meet at a barrier after each quantum, so no core runs
+   more than one quantum ahead of another */
+
+#define MC_QUANTUM 1000
+
+/* the other caches see m's bus request for address: a modified copy is
+   supplied and written back, and every copy becomes shared, or is
+   invalidated if m is going to write.  Returns whether any was held */
+int snoop( struct machine *m, unsigned int address, int exclusive ){
+  struct multicore *mc = m->mc;
+  int held = 0;
+
+  for( int k = 0; k < mc->num_cores; k++ ){
+    struct cache *c = &mc->cores[ k ]->cache;
+    struct coherence *h = &mc->coh[ k ];
+    int line = cache_find( c, address );
+    if( ( k == m->core ) || ( line < 0 ) ) continue;
+    held = 1;
+    if( line_dirty( c, line ) ){
+      h->interventions++;
+      line_set_dirty( c, line, 0 );
+    }
+    if( exclusive ){
+      line_invalidate( c, line );
+      h->invalidations++;
+    }else{
+      h->shared[ line ] = 1;
+    }
+  }
+  return held;
+}
+
+/* cache_access() for a core, with the bus lock held */
+void coherent_access( struct machine *m, unsigned int address, unsigned int type ){
+  struct coherence *h = &m->mc->coh[ m->core ];
+  struct cache *c = &m->cache;
+  int line = cache_find( c, address ), shared = 0;
+
+  if( type == 0 ){
+    if( line < 0 ){
+      h->bus_reads++;
+      shared = snoop( m, address, 0 );
+    }else{
+      shared = h->shared[ line ];
+    }
+  }else if( line < 0 ){
+    h->bus_read_exclusives++;
+    snoop( m, address, 1 );
+  }else if( h->shared[ line ] ){
+    h->upgrades++;
+    snoop( m, address, 1 );
+  }
+  cache_access( c, address, type );
+  h->shared[ cache_find( c, address ) ] = shared;
+}
+
+/* a core's TLB miss: the page comes from the shared directory, with a
+   page of pre-decode records for every core allocated so that
+   decoded_at() never allocates on a core.  Running out of memory for
+   either happens with no lock held */
+struct page *shared_page_fill( struct machine *m, unsigned int addr ){
+  struct multicore *mc = m->mc;
+
+  pthread_mutex_lock( &mc->pages );
+  struct page *p = page_find( mc->memory, addr >> PAGE_SHIFT );
+  if( p && !p->decoded ) p->decoded = calloc( mc->num_cores * PAGE_WORDS, sizeof( struct decoded ) );
+  int found = p && p->decoded;
+  pthread_mutex_unlock( &mc->pages );
+  if( !found ) out_of_memory();
+
+  struct tlb_entry *e = &m->tlb[ ( addr >> PAGE_SHIFT ) & ( TLB_SIZE - 1 ) ];
+  e->vpn  = addr >> PAGE_SHIFT;
+  e->page = p;
+  return p;
+}
+
+void *core_main( void *arg ){
+  struct machine *m = arg;
+  struct multicore *mc = m->mc;
+  jmp_buf escape;
+  int running;
+
+  /* a core that runs out of memory says so and halts, and the failure
+     stops every core at the next barrier for run_multicore() to end the
+     run from its own thread */
+  fail_escape = &escape;
+  fail_out = m->out;
+  if( setjmp( escape ) ){
+    __atomic_store_n( &mc->failed, 1, __ATOMIC_RELAXED );
+    m->halt_flag = 1;
+  }
+
+  do{
+    for( int i = 0; ( i < mc->quantum ) && !m->halt_flag; i++ ){
+      /* only this core fills its records, and it does so under the bus
+         lock that a store holds to clear them, so a record is never
+         left valid over a word stored after it was decoded */
+      struct decoded *di = decoded_at( m, m->fip ) + m->core * PAGE_WORDS;
+      if( !__atomic_load_n( &di->valid, __ATOMIC_ACQUIRE ) ){
+        pthread_mutex_lock( &mc->bus );
+        predecode( m, m->fip );
+        pthread_mutex_unlock( &mc->bus );
+      }
+      execute( m, di );
+    }
+
+    /* halt flags only change inside a quantum, so every core reaches
+       the same answer between the two barriers */
+    pthread_barrier_wait( &mc->barrier );
+    running = 0;
+    for( int k = 0; k < mc->num_cores; k++ ) running |= !mc->cores[ k ]->halt_flag;
+    running &= !mc->failed;
+    pthread_barrier_wait( &mc->barrier );
+  }while( running );
+  return NULL;
+}
+
+void print_coherence( struct coherence *h, FILE *out ){
+  fprintf( out, "coherence statistics (in decimal):\n" );
+  fprintf( out, "  bus reads           = %d\n", h->bus_reads );
+  fprintf( out, "  bus read exclusives = %d\n", h->bus_read_exclusives );
+  fprintf( out, "  bus upgrades        = %d\n", h->upgrades );
+  fprintf( out, "  invalidations       = %d\n", h->invalidations );
+  fprintf( out, "  interventions       = %d\n", h->interventions );
+}
+
+/* run the loaded program on n cores and report each core and their sum */
+void run_multicore( struct machine *m, int n, int quantum ){
+  struct multicore mc = { .num_cores = n, .quantum = quantum, .memory = m };
+  struct machine *total = machine_create( m->out );
+  struct coherence sum = { 0 };
+  pthread_t threads[n];
+
+  mc.cores = calloc( n, sizeof( struct machine * ) );
+  mc.coh = calloc( n, sizeof( struct coherence ) );
+  if( !mc.cores || !mc.coh ) out_of_memory();
+  pthread_mutex_init( &mc.bus, NULL );
+  pthread_mutex_init( &mc.pages, NULL );
+  pthread_barrier_init( &mc.barrier, NULL, n );
+
+  /* records the loading machine decoded have no room for the cores' */
+  for( struct page *p = m->pages; p; p = p->next ){
+    free( p->decoded );
+    p->decoded = NULL;
+  }
+
+  for( int k = 0; k < n; k++ ){
+    struct machine *c = mc.cores[ k ] = machine_create( m->out );
+    c->mc = &mc;
+    c->core = k;
+    c->job = m->job;
+    cache_configure( &c->cache, m->cache.sets, m->cache.ways, m->cache.line_size );
+    c->cache.policy = m->cache.policy;
+    mc.coh[ k ].shared = calloc( m->cache.sets * m->cache.ways, 1 );
+    if( !mc.coh[ k ].shared ) out_of_memory();
+    c->fip = m->fip;
+    c->reg[ 30 ] = n;
+    c->reg[ 31 ] = k;
+  }
+
+  /* decode the program before the cores start, so they only decode
+     words that are not part of the image */
+  for( int k = 0; k < n; k++ ){
+    for( int i = 0; i < m->image.num_segments; i++ ){
+      struct segment *s = &m->image.segments[ i ];
+      for( int j = 0; j < s->words; j++ ) predecode( mc.cores[ k ], s->addr + 4 * j );
+    }
+  }
+  for( int k = 0; k < n; k++ ) pthread_create( &threads[ k ], NULL, core_main, mc.cores[ k ] );
+  for( int k = 0; k < n; k++ ) pthread_join( threads[ k ], NULL );
+
+  for( int k = 0; ( k < n ) && !mc.failed; k++ ){
+    struct machine *c = mc.cores[ k ];
+    struct coherence *h = &mc.coh[ k ];
+    fprintf( m->out, "core %d:\n", k );
+    print_stats( c );
+    print_coherence( h, m->out );
+    fprintf( m->out, "\n" );
+
+    total->inst_fetches       += c->inst_fetches;
+    total->memory_reads       += c->memory_reads;
+    total->memory_writes      += c->memory_writes;
+    total->branches           += c->branches;
+    total->taken              += c->taken;
+    total->cache.cache_reads  += c->cache.cache_reads;
+    total->cache.cache_writes += c->cache.cache_writes;
+    total->cache.hits         += c->cache.hits;
+    total->cache.misses       += c->cache.misses;
+    total->cache.write_backs  += c->cache.write_backs;
+    sum.bus_reads           += h->bus_reads;
+    sum.bus_read_exclusives += h->bus_read_exclusives;
+    sum.upgrades            += h->upgrades;
+    sum.invalidations       += h->invalidations;
+    sum.interventions       += h->interventions;
+  }
+  if( !mc.failed ){
+    fprintf( m->out, "all cores:\n" );
+    print_stats( total );
+    print_coherence( &sum, m->out );
+  }
+
+  for( int k = 0; k < n; k++ ){
+    free( mc.coh[ k ].shared );
+    machine_free( mc.cores[ k ] );
+  }
+  machine_free( total );
+  pthread_barrier_destroy( &mc.barrier );
+  pthread_mutex_destroy( &mc.bus );
+  pthread_mutex_destroy( &mc.pages );
+  free( mc.cores );
+  free( mc.coh );
+  if( mc.failed ) fail();
+}
+
+/* batched execution: -L file runs the loaded program once for each line
+   of file, starting the instance with the registers and memory words
+   the line sets as rN=value and [address]=value.  Instances run LANES at
+   a time as the lanes of one vector machine: each register is a vector
+   holding it for every lane, so an instruction is decoded once and its
+   arithmetic done for all lanes together.  Every lane keeps a machine of
+   its own for its memory, cache and report, and loads and stores go to
+   it one lane at a time.
+
+   The lanes at the lowest pc run each step, so lanes that branched apart
+   wait for each other and run together again where their paths meet.
+   Instructions are fetched from the loaded program, which no lane runs.
+   A lane that stores into the program's address range or starts with
+   different words there, and any lane that runs code outside it, leaves
+   the vector machine and finishes on the scalar engine.  So do all the
+   lanes once they have diverged so far that the vector steps of a
+   window average under half the lanes, where the scalar engine is the
+   faster.  The vectors use the widest registers the compiler targets;
+   build with -march=native to use AVX2 or AVX-512 */
+
+#define LANES 16
+#define LANE_WINDOW 65536       /* vector steps between checks of lane use */
+
+typedef int lane_vec __attribute__(( vector_size( 4 * LANES ) ));
+
+struct lanes {
+  lane_vec reg[32],           /* register r of lane l is reg[r][l]    */
+           cc, fip,
+           fetches, reads, writes, branches, taken;
+  unsigned int live,          /* lanes still in the vector machine    */
+               lo, size;      /* the program's address range          */
+  struct machine *code,       /* the loaded program                   */
+                 *m[LANES];   /* each lane's memory, cache and report */
+  long long steps,            /* vector steps                         */
+            lane_steps;       /* instructions run by them             */
+};
+
+/* vectors are passed by address, since the host may have no registers
+   wide enough to pass them in */
+static inline unsigned int lane_bits( const lane_vec *v ){
+  unsigned int bits = 0;
+  for( int l = 0; l < LANES; l++ ) if( ( *v )[ l ] ) bits |= 1u << l;
+  return bits;
+}
+
+static inline void lane_mask( lane_vec *v, unsigned int bits ){
+  for( int l = 0; l < LANES; l++ ) ( *v )[ l ] = ( bits >> l ) & 1 ? -1 : 0;
+}
+
+/* move lane l's state into its machine and take it out of the vector
+   machine */
+void lane_leave( struct lanes *ln, int l ){
+  struct machine *lm = ln->m[ l ];
+
+  for( int r = 0; r < 32; r++ ) lm->reg[ r ] = ln->reg[ r ][ l ];
+  lm->cc_bit        = ln->cc[ l ];
+  lm->fip           = ln->fip[ l ];
+  lm->inst_fetches  = ln->fetches[ l ];
+  lm->memory_reads  = ln->reads[ l ];
+  lm->memory_writes = ln->writes[ l ];
+  lm->branches      = ln->branches[ l ];
+  lm->taken         = ln->taken[ l ];
+  ln->live &= ~( 1u << l );
+}
+
+/* run an instruction the vector machine has no code for through its
+   handler, lane by lane */
+void lane_call( struct lanes *ln, unsigned int group, struct decoded *di, int pc ){
+  for( int l = 0; l < LANES; l++ ){
+    struct machine *lm = ln->m[ l ];
+    if( !( ( group >> l ) & 1 ) ) continue;
+    for( int r = 0; r < 32; r++ ) lm->reg[ r ] = ln->reg[ r ][ l ];
+    lm->cc_bit = ln->cc[ l ];
+    lm->xip    = pc;
+    lm->fip    = pc + 4;
+    lm->ir     = di->ir;
+    lm->op1    = di->op1;
+    lm->d      = di->d;
+    lm->s1     = di->s1;
+    lm->s2     = di->s2;
+    lm->genset = di->genset;
+    lm->memory_reads = lm->memory_writes = lm->branches = lm->taken = 0;
+    di->handler( lm );
+    lm->reg[ 0 ] = 0;
+    for( int r = 0; r < 32; r++ ) ln->reg[ r ][ l ] = lm->reg[ r ];
+    ln->cc[ l ]        = lm->cc_bit;
+    ln->fip[ l ]       = lm->fip;
+    ln->reads[ l ]    += lm->memory_reads;
+    ln->writes[ l ]   += lm->memory_writes;
+    ln->branches[ l ] += lm->branches;
+    ln->taken[ l ]    += lm->taken;
+    if( lm->halt_flag ) lane_leave( ln, l );
+  }
+}
+
+/* shift counts are taken mod 32, as the scalar engines' host shifts do */
+#define BLEND( old, new ) ( ( ( new ) & mask ) | ( ( old ) & ~mask ) )
+
+void run_lanes( struct lanes *ln ){
+  unsigned int group = 0, next = 0, leaving, taken;
+  lane_vec mask = { 0 }, *reg = ln->reg, c, t;
+  struct decoded *di;
+  int pc = 0, addr, l;
+  int window = LANE_WINDOW;
+  long long window_lanes = 0;
+
+  while( ln->live ){
+    if( --window == 0 ){
+      if( ln->lane_steps - window_lanes < LANE_WINDOW * ( LANES / 2 ) ){
+        for( l = 0; l < LANES; l++ ) if( ( ln->live >> l ) & 1 ) lane_leave( ln, l );
+        return;
+      }
+      window = LANE_WINDOW;
+      window_lanes = ln->lane_steps;
+    }
+
+    /* find the lowest pc and the lanes at it when the group splits or
+       reaches the pc of the next lowest lanes, which then join it */
+    if( !group || ( (unsigned)pc >= next ) ){
+      unsigned int low = ~0u;
+      for( l = 0; l < LANES; l++ ){
+        if( ( ( ln->live >> l ) & 1 ) && ( (unsigned)ln->fip[ l ] < low ) ) low = ln->fip[ l ];
+      }
+      pc = low;
+      c = ln->fip == pc;
+      group = lane_bits( &c ) & ln->live;
+      lane_mask( &mask, group );
+      next = ~0u;
+      for( l = 0; l < LANES; l++ ){
+        if( ( ( ( ln->live & ~group ) >> l ) & 1 ) && ( (unsigned)ln->fip[ l ] < next ) ) next = ln->fip[ l ];
+      }
+    }
+    if( (unsigned)( pc - ln->lo ) >= ln->size ){
+      for( l = 0; l < LANES; l++ ) if( ( group >> l ) & 1 ) lane_leave( ln, l );
+      group = 0;
+      continue;
+    }
+
+    di = decoded_at( ln->code, pc );
+    if( !di->valid ) predecode( ln->code, pc );
+    ln->steps++;
+    ln->lane_steps += __builtin_popcount( group );
+    ln->fetches -= mask;
+    leaving = 0;
+    c = mask;
+
+    switch( di->op1 ){
+      case 0x00:
+        ln->fip += mask & 4;
+        for( l = 0; l < LANES; l++ ){
+          if( ( group >> l ) & 1 ){
+            lane_leave( ln, l );
+            ln->m[ l ]->halt_flag = 1;
+          }
+        }
+        group = 0;
+        continue;
+
+      case 0x04:
+      case 0x05:
+        for( l = 0; l < LANES; l++ ){
+          if( !( ( group >> l ) & 1 ) ) continue;
+          addr = ( di->op1 == 0x04 ) ? ( ( ( reg[ di->s1 ][ l ] + reg[ di->s2 ][ l ] ) << 16 ) >> 16 )
+                                     : (short)( di->imm + reg[ di->s2 ][ l ] );
+          cache_access( &ln->m[ l ]->cache, addr, 0 );
+          reg[ di->d ][ l ] = *mem_word( ln->m[ l ], addr );
+        }
+        ln->reads -= mask;
+        break;
+
+      case 0x07:
+        for( l = 0; l < LANES; l++ ){
+          if( !( ( group >> l ) & 1 ) ) continue;
+          addr = (short)( di->imm + reg[ di->s2 ][ l ] );
+          cache_access( &ln->m[ l ]->cache, addr, 1 );
+          *mem_word( ln->m[ l ], addr ) = reg[ di->s1 ][ l ];
+          if( (unsigned)( addr - ln->lo ) < ln->size ) leaving |= 1u << l;
+        }
+        ln->writes -= mask;
+        break;
+
+      /* the group's lanes take the result and cc, the others keep theirs */
+      case 0x24:
+        t = reg[ di->s2 ];
+        reg[ di->d ] = BLEND( reg[ di->d ], reg[ di->s1 ] + t );
+        ln->cc = BLEND( ln->cc, ( t < ( ~reg[ di->s1 ] + 1 ) ) & 1 );
+        break;
+      case 0x25:
+        reg[ di->d ] = BLEND( reg[ di->d ], reg[ di->s2 ] + di->imm );
+        ln->cc = BLEND( ln->cc, ( reg[ di->s2 ] < -di->imm ) & 1 );
+        break;
+      case 0x26:
+        reg[ di->d ] = BLEND( reg[ di->d ], reg[ di->s1 ] - reg[ di->s2 ] );
+        ln->cc = BLEND( ln->cc, ( reg[ di->s2 ] > reg[ di->s1 ] ) & 1 );
+        break;
+      case 0x28:
+        reg[ di->d ] = BLEND( reg[ di->d ], reg[ di->s2 ] << ( reg[ di->s1 ] & 31 ) );
+        break;
+      case 0x29:
+        reg[ di->d ] = BLEND( reg[ di->d ], reg[ di->s2 ] << ( di->genset & 31 ) );
+        break;
+      case 0x2b:
+      case 0x2f:
+        reg[ di->d ] = BLEND( reg[ di->d ], reg[ di->s2 ] >> ( di->genset & 31 ) );
+        break;
+      case 0x2e:
+        reg[ di->d ] = BLEND( reg[ di->d ], reg[ di->s2 ] >> ( reg[ di->s1 ] & 31 ) );
+        break;
+
+      /* a branch keeps the group together if all of it goes the same way;
+         one with a zero displacement is left to the handler to report */
+      case 0x14: c = reg[ di->s1 ] != reg[ di->s2 ]; goto branch;
+      case 0x15: c = reg[ di->s2 ] != di->s1;        goto branch;
+      case 0x16: c = reg[ di->s1 ] == reg[ di->s2 ]; goto branch;
+      case 0x17: c = reg[ di->s2 ] == di->s1;        goto branch;
+      case 0x1a:                                     goto branch;
+      case 0x1c: c = ln->cc == 1;                    goto branch;
+      case 0x1e: c = ln->cc == 0;
+      branch:
+        if( !di->imm && ( di->op1 != 0x14 ) ) goto call;
+        c &= mask;
+        ln->branches -= mask;
+        ln->taken -= c;
+        ln->fip += ( mask & 4 ) + ( c & ( di->imm << 2 ) );
+        taken = lane_bits( &c );
+        if( taken == 0 ){
+          pc += 4;
+        }else if( taken == group ){
+          pc += 4 + ( di->imm << 2 );
+        }else{
+          group = 0;
+        }
+        reg[ 0 ] = ( lane_vec ){ 0 };
+        continue;
+
+      default:
+      call:
+        lane_call( ln, group, di, pc );
+        reg[ 0 ] = ( lane_vec ){ 0 };
+        group = 0;
+        continue;
+    }
+
+    reg[ 0 ] = ( lane_vec ){ 0 };
+    ln->fip += mask & 4;
+    pc += 4;
+    if( leaving ){
+      for( l = 0; l < LANES; l++ ) if( ( leaving >> l ) & 1 ) lane_leave( ln, l );
+      group = 0;
+    }
+  }
+}
+
+#undef BLEND
+
+/* read one instance line into a fresh lane machine; returns 0 if the
+   line is not understood */
+int lane_setup( struct lanes *ln, int l, struct machine *m, char *line ){
+  struct machine *lm = ln->m[ l ] = machine_create( m->out );
+  int inside = 0;
+
+  lm->image = m->image;
+  install_image( lm );
+  lm->image = ( struct image ){ 0 };
+  cache_configure( &lm->cache, m->cache.sets, m->cache.ways, m->cache.line_size );
+  lm->cache.policy = m->cache.policy;
+  lm->cache.off = m->cache.off;
+  lm->job = m->job;
+
+  for( char *p = line; *( p += strspn( p, " \t" ) ); ){
+    if( *p == 'r' ){
+      long r = strtol( p + 1, &p, 10 );
+      if( ( *p != '=' ) || ( r < 0 ) || ( r > 31 ) ) return 0;
+      lm->reg[ r ] = strtoll( p + 1, &p, 0 );
+    }else if( *p == '[' ){
+      unsigned int addr = strtoul( p + 1, &p, 0 );
+      if( ( *p++ != ']' ) || ( *p != '=' ) || ( addr & 3 ) ) return 0;
+      *mem_word( lm, addr ) = strtoll( p + 1, &p, 0 );
+      if( addr - ln->lo < ln->size ) inside = 1;
+    }else{
+      return 0;
+    }
+    if( *p && ( *p != ' ' ) && ( *p != '\t' ) ) return 0;
+  }
+  lm->reg[ 0 ] = 0;
+
+  for( int r = 0; r < 32; r++ ) ln->reg[ r ][ l ] = lm->reg[ r ];
+  ln->fip[ l ] = lm->fip;
+  if( !inside ) ln->live |= 1u << l;
+  return 1;
+}
+
+/* run the loaded program once per line of the lane file */
+void run_lane_file( struct machine *m, const char *name, void (*scalar)( struct machine *m ) ){
+  FILE *f = fopen( name, "r" );
+  char line[1024], *text[LANES];
+  long long instructions = 0, steps = 0, lane_steps = 0;
+  int instances = 0, more = 1;
+
+  if( !f ){
+    fprintf( m->out, "cannot read %s\n", name );
+    return;
+  }
+
+  while( more ){
+    struct lanes ln;
+    int n = 0;
+
+    memset( &ln, 0, sizeof( ln ) );
+    ln.code = m;
+    ln.lo = ~0u;
+    for( int i = 0; i < m->image.num_segments; i++ ){
+      struct segment *s = &m->image.segments[ i ];
+      if( (unsigned)s->addr < ln.lo ) ln.lo = s->addr;
+    }
+    for( int i = 0; i < m->image.num_segments; i++ ){
+      struct segment *s = &m->image.segments[ i ];
+      unsigned int end = s->addr + 4 * ( s->words + s->fill );
+      if( end - ln.lo > ln.size ) ln.size = end - ln.lo;
+    }
+
+    while( ( n < LANES ) && ( more = ( fgets( line, sizeof( line ), f ) != NULL ) ) ){
+      line[ strcspn( line, "\r\n" ) ] = '\0';
+      char *first = line + strspn( line, " \t" );
+      if( ( *first == '\0' ) || ( *first == '#' ) ) continue;
+      text[ n ] = strdup( first );
+      if( !lane_setup( &ln, n, m, first ) ){
+        fprintf( m->out, "bad instance %d: %s\n", instances + n + 1, text[ n ] );
+        for( int l = 0; l <= n; l++ ){
+          machine_free( ln.m[ l ] );
+          free( text[ l ] );
+        }
+        fclose( f );
+        return;
+      }
+      n++;
+    }
+    if( n == 0 ) break;
+
+    run_lanes( &ln );
+    steps += ln.steps;
+    lane_steps += ln.lane_steps;
+
+    for( int l = 0; l < n; l++ ){
+      struct machine *lm = ln.m[ l ];
+      if( !lm->halt_flag ) scalar( lm );
+      fprintf( m->out, "instance %d: %s\n", ++instances, text[ l ] );
+      print_regs( lm );
+      print_stats( lm );
+      fprintf( m->out, "\n" );
+      instructions += lm->inst_fetches;
+      machine_free( lm );
+      free( text[ l ] );
+    }
+  }
+  fclose( f );
+
+  fprintf( m->out, "lane statistics (in decimal):\n" );
+  fprintf( m->out, "  instances           = %d\n", instances );
+  fprintf( m->out, "  instructions        = %lld\n", instructions );
+  fprintf( m->out, "  in vector steps     = %lld (%.1f%%)\n", lane_steps,
+    instructions ? 100.0 * lane_steps / instructions : 0.0 );
+  fprintf( m->out, "  vector steps        = %lld (%.1f lanes each)\n", steps,
+    steps ? (double)lane_steps / steps : 0.0 );
+}
+
+/* snapshots: the complete state of a machine at one instruction count.
+   Each page is saved as a frame, and a page not stored to since the
+   machine's last snapshot reuses that snapshot's frame, so a series of
+   snapshots of one run costs only the pages changed in between.  The
+   loaded image is not part of a snapshot; a snapshot file carries it
+   so that it can be resumed in another process.  A file is
+
+     header    "i86s", version (5), image bytes, number of pages
+     image     the program, as written by -w
+     state     the fields of snapshot_fields(): registers, counters,
+               and the cache's geometry, policy state and counters
+     cache     the block of each set: tree bits, dirty bits and
+               entries, then the rank of each line
+     pages     page number and words of each page */
+
+#define SNAPSHOT_MAGIC   0x73363869  /* "i86s" */
+#define SNAPSHOT_VERSION 5
+#define SNAPSHOT_FIELDS  52  /* 32-bit values in the state block */
+
+struct snapshot {
+  int reg[32], xip, fip, halt_flag, cc_bit,
+      inst_fetches, memory_reads, memory_writes, branches, taken;
+  struct cache cache;
+  int num_pages;
+  unsigned int *vpn;
+  struct frame **frames;
+};
+
+/* point f at the fields of s that make up the state block, in file
+   order.  The cache's other fields follow from its geometry, so the
+   block does not depend on how the compiler lays out the structs */
+void snapshot_fields( struct snapshot *s, uint32_t **f ){
+  struct cache *c = &s->cache;
+  int n = 0;
+
+  for( int i = 0; i < 32; i++ ) f[ n++ ] = (uint32_t *)&s->reg[ i ];
+  f[ n++ ] = (uint32_t *)&s->xip;
+  f[ n++ ] = (uint32_t *)&s->fip;
+  f[ n++ ] = (uint32_t *)&s->halt_flag;
+  f[ n++ ] = (uint32_t *)&s->cc_bit;
+  f[ n++ ] = (uint32_t *)&s->inst_fetches;
+  f[ n++ ] = (uint32_t *)&s->memory_reads;
+  f[ n++ ] = (uint32_t *)&s->memory_writes;
+  f[ n++ ] = (uint32_t *)&s->branches;
+  f[ n++ ] = (uint32_t *)&s->taken;
+  f[ n++ ] = &c->sets;
+  f[ n++ ] = &c->ways;
+  f[ n++ ] = &c->line_size;
+  f[ n++ ] = &c->policy;
+  f[ n++ ] = &c->psel;
+  f[ n++ ] = &c->seed;
+  f[ n++ ] = &c->cache_reads;
+  f[ n++ ] = &c->cache_writes;
+  f[ n++ ] = &c->hits;
+  f[ n++ ] = &c->misses;
+  f[ n++ ] = &c->write_backs;
+  assert( n == SNAPSHOT_FIELDS );
+}
+
+void snapshot_unpack( struct snapshot *s, const char *p ){
+  uint32_t *f[SNAPSHOT_FIELDS];
+
+  snapshot_fields( s, f );
+  for( int i = 0; i < SNAPSHOT_FIELDS; i++ ) memcpy( f[ i ], p + 4 * i, 4 );
+}
+
+struct snapshot_header {
+  uint32_t magic, version, image_size, num_pages;
+};
+
+struct snapshot *snapshot_alloc( int num_pages ){
+  struct snapshot *s = calloc( 1, sizeof( *s ) );
+  if( s ){
+    s->num_pages = num_pages;
+    s->vpn = malloc( num_pages * sizeof( unsigned int ) + 1 );
+    s->frames = malloc( num_pages * sizeof( struct frame * ) + 1 );
+  }
+  if( !s || !s->vpn || !s->frames ) out_of_memory();
+  return s;
+}
+
+struct frame *frame_alloc(){
+  struct frame *f = malloc( sizeof( *f ) );
+  if( !f ) out_of_memory();
+  f->refs = 1;
+  return f;
+}
+
+struct snapshot *snapshot_take( struct machine *m ){
+  struct snapshot *s = snapshot_alloc( m->num_pages );
+  int i = 0;
+
+  memcpy( s->reg, m->reg, sizeof( s->reg ) );
+  s->xip           = m->xip;
+  s->fip           = m->fip;
+  s->halt_flag     = m->halt_flag;
+  s->cc_bit        = m->cc_bit;
+  s->inst_fetches  = m->inst_fetches;
+  s->memory_reads  = m->memory_reads;
+  s->memory_writes = m->memory_writes;
+  s->branches      = m->branches;
+  s->taken         = m->taken;
+  cache_copy( &s->cache, &m->cache );
+
+  for( struct page *p = m->pages; p; p = p->next, i++ ){
+    if( p->dirty || !p->saved ){
+      frame_release( p->saved );
+      p->saved = frame_alloc();
+      memcpy( p->saved->word, p->word, sizeof( p->word ) );
+      p->dirty = 0;
+    }
+    s->vpn[ i ] = p->vpn;
+    s->frames[ i ] = p->saved;
+    p->saved->refs++;
+  }
+  return s;
+}
+
+/* put the machine in the snapshot's state; the image stays as it is */
+void snapshot_restore( struct machine *m, struct snapshot *s ){
+  memcpy( m->reg, s->reg, sizeof( m->reg ) );
+  m->xip           = s->xip;
+  m->fip           = s->fip;
+  m->halt_flag     = s->halt_flag;
+  m->cc_bit        = s->cc_bit;
+  m->inst_fetches  = s->inst_fetches;
+  m->memory_reads  = s->memory_reads;
+  m->memory_writes = s->memory_writes;
+  m->branches      = s->branches;
+  m->taken         = s->taken;
+  cache_copy( &m->cache, &s->cache );
+
+  if( m->jit ) jit_reset( m->jit );
+  mem_free( m );
+  for( int i = 0; i < s->num_pages; i++ ){
+    struct page *p = page_fill( m, s->vpn[ i ] << PAGE_SHIFT );
+    memcpy( p->word, s->frames[ i ]->word, sizeof( p->word ) );
+    p->saved = s->frames[ i ];
+    p->saved->refs++;
+  }
+}
+
+void snapshot_free( struct snapshot *s ){
+  for( int i = 0; i < s->num_pages; i++ ) frame_release( s->frames[ i ] );
+  cache_free( &s->cache );
+  free( s->vpn );
+  free( s->frames );
+  free( s );
+}
+
+/* out may be a file or a memory stream */
+void snapshot_write( struct machine *m, struct snapshot *s, FILE *out ){
+  struct snapshot_header h = { SNAPSHOT_MAGIC, SNAPSHOT_VERSION, image_size( &m->image ), s->num_pages };
+
+  fwrite( &h, sizeof( h ), 1, out );
+  write_image( m, out );
+  uint32_t *f[SNAPSHOT_FIELDS];
+  snapshot_fields( s, f );
+  for( int i = 0; i < SNAPSHOT_FIELDS; i++ ) fwrite( f[ i ], sizeof( uint32_t ), 1, out );
+  fwrite( s->cache.data, sizeof( uint64_t ), s->cache.sets * s->cache.set_words, out );
+  fwrite( s->cache.rank, 1, s->cache.sets * s->cache.ways, out );
+  for( int i = 0; i < s->num_pages; i++ ){
+    fwrite( &s->vpn[ i ], sizeof( uint32_t ), 1, out );
+    fwrite( s->frames[ i ]->word, sizeof( int ), PAGE_WORDS, out );
+  }
+}
+
+/* read a snapshot file, taking the program image into m */
+struct snapshot *snapshot_read( struct machine *m, FILE *in ){
+  struct snapshot_header h = { 0 };
+  struct snapshot state = { 0 };   /* the state block, to check the cache geometry */
+  struct cache *c = &state.cache;
+  size_t size;
+  int mapped;
+  char *buf = read_input( in, &size, &mapped ), *p;
+
+  if( size >= sizeof( h ) ) memcpy( &h, buf, sizeof( h ) );
+  if( sizeof( h ) + (uint64_t)h.image_size + 4 * SNAPSHOT_FIELDS <= size ){
+    snapshot_unpack( &state, buf + sizeof( h ) + h.image_size );
+  }
+  uint64_t words = (uint64_t)c->sets * ( SET_TAGS + ( c->ways + 1 ) / 2 );
+  if( ( h.magic != SNAPSHOT_MAGIC ) || ( h.version != SNAPSHOT_VERSION ) ||
+      !cache_geometry_ok( c->sets, c->ways, c->line_size ) || ( c->policy >= NUM_POLICIES ) ||
+      ( sizeof( h ) + (uint64_t)h.image_size + 4 * SNAPSHOT_FIELDS +
+        words * sizeof( uint64_t ) + (uint64_t)c->sets * c->ways +
+        (uint64_t)h.num_pages * ( sizeof( uint32_t ) + sizeof( int ) * PAGE_WORDS ) != size ) ){
+    fprintf( m->out, "bad snapshot\n" );
+    exit( -1 );
+  }
+
+  if( parse_binary( m, buf + sizeof( h ), h.image_size ) ) exit( -1 );
+  struct snapshot *s = snapshot_alloc( h.num_pages );
+  p = buf + sizeof( h ) + h.image_size;
+  cache_configure( &s->cache, c->sets, c->ways, c->line_size );
+  snapshot_unpack( s, p );
+  p += 4 * SNAPSHOT_FIELDS;
+  memcpy( s->cache.data, p, words * sizeof( uint64_t ) );
+  p += words * sizeof( uint64_t );
+  memcpy( s->cache.rank, p, c->sets * c->ways );
+  p += c->sets * c->ways;
+  for( uint32_t i = 0; i < h.num_pages; i++ ){
+    memcpy( &s->vpn[ i ], p, sizeof( uint32_t ) );
+    s->frames[ i ] = frame_alloc();
+    memcpy( s->frames[ i ]->word, p + sizeof( uint32_t ), sizeof( int ) * PAGE_WORDS );
+    p += sizeof( uint32_t ) + sizeof( int ) * PAGE_WORDS;
+  }
+
+  if( mapped ){
+    munmap( buf, size );
+  }else{
+    free( buf );
+  }
+  return s;
+}
+
+double now_seconds(){
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#define NUM_ENGINES 3
+const char *engine_names[NUM_ENGINES] = { "basic", "threaded", "jit" };
+void (*engines[NUM_ENGINES])( struct machine *m ) = { run_basic, run_threaded, run_jit };
+
+
+/* command-line settings; batch job lines are parsed with the same rules */
+struct options {
+  int verbose,           /* 1 for -t, 2 for -v               */
+      engine,            /* index into engines[]             */
+      policy,            /* -c, index into policy_names[]    */
+      cache_off,         /* -c off                           */
+      geometry[3],       /* -G sets ways line, or 0          */
+      hierarchy[NUM_LEVELS][4], /* -H level sets ways line [inclusion] */
+      bench_runs,        /* -b n                             */
+      snapshot_at,       /* instruction count for -s         */
+      profile,           /* -P: 1 for text, 2 for CSV        */
+      predict,           /* -B                               */
+      timing,            /* -C                               */
+      ilp,               /* -I                               */
+      mrc,               /* -M                               */
+      policies,          /* -R                               */
+      sample[3],         /* -S fast-forward warm-up measure  */
+      cores,             /* -N n                             */
+      quantum,           /* -q n, instructions per quantum   */
+      threads,           /* -p n, batch worker threads       */
+      export,            /* -O: 1 for JSON, 2 for CSV        */
+      interval;          /* -i n, instructions per sample    */
+  char *translate_file,  /* -x file.c                        */
+       *image_file,      /* -w file.img                      */
+       *trace_file,      /* -T file.trc                      */
+       *snapshot_file,   /* -s n file                        */
+       *resume_file,     /* -r file                          */
+       *lane_file,       /* -L file                          */
+       *job_file,        /* -j file                          */
+       *export_file;     /* -O format file                   */
+};
+
+int hierarchy_used( struct options *o ){
+  for( int level = 0; level < NUM_LEVELS; level++ ){
+    if( o->hierarchy[ level ][0] ) return 1;
+  }
+  return 0;
+}
+
+/* whether the levels of -H fit together: L3 needs L2, no level has
+   smaller lines than one above it, and an exclusive level has the line
+   size of those above */
+int hierarchy_ok( struct options *o ){
+  int (*l)[4] = o->hierarchy,
+      data = o->geometry[0] ? o->geometry[2] : CACHE_LINE,
+      code = l[0][0] ? l[0][2] : CACHE_LINE;
+
+  if( l[2][0] && !l[1][0] ) return 0;
+  if( l[1][0] ){
+    if( ( l[1][2] < data ) || ( l[1][2] < code ) ) return 0;
+    if( ( l[1][3] == EXCLUSIVE ) && ( ( l[1][2] != data ) || ( l[1][2] != code ) ) ) return 0;
+  }
+  if( l[2][0] ){
+    if( l[2][2] < l[1][2] ) return 0;
+    if( ( l[2][3] == EXCLUSIVE ) && ( l[2][2] != l[1][2] ) ) return 0;
+  }
+  return 1;
+}
+
+/* returns 0 if an argument is not understood, if -T, -s, -P, -B, -C,
+   -I, -M, -R, -H or -S is combined with a text trace, -T with a
+   snapshot or the instrumented engine, -S with the instrumented
+   engine, or -N with any of those or another engine, -L with any of
+   those or -N, -c off with -S, -N or -H, -O with -N or -L, -i without
+   -O or with a trace or -S, -G, -H or a -c policy with -r, or the
+   levels of -H do not fit together; a
+   trace has to start at the program's first instruction, the cores of
+   -N and the lanes of -L run their own loops, sampling, coherence and
+   the hierarchy need the cache, -O reports on a single machine, and a
+   snapshot keeps its own cache */
+int parse_options( struct options *o, int argc, char **argv, int first ){
+  for( int i = first; i < argc; i++ ){
+    if( strcmp( argv[i], "-t" ) == 0 ){
+      o->verbose = 1;
+    }else if( strcmp( argv[i], "-v" ) == 0 ){
+      o->verbose = 2;
+    }else if( ( strcmp( argv[i], "-e" ) == 0 ) && ( i + 1 < argc ) ){
+      i++;
+      for( o->engine = 0; o->engine < NUM_ENGINES; o->engine++ ){
+        if( strcmp( argv[i], engine_names[ o->engine ] ) == 0 ) break;
+      }
+      if( o->engine == NUM_ENGINES ) return 0;
+    }else if( ( strcmp( argv[i], "-c" ) == 0 ) && ( i + 1 < argc ) ){
+      i++;
+      o->policy = o->cache_off = 0;
+      if( strcmp( argv[i], "off" ) == 0 ){
+        o->cache_off = 1;
+      }else{
+        for( o->policy = 0; o->policy < NUM_POLICIES; o->policy++ ){
+          if( strcmp( argv[i], policy_names[ o->policy ] ) == 0 ) break;
+        }
+        if( o->policy == NUM_POLICIES ) return 0;
+      }
+    }else if( ( strcmp( argv[i], "-G" ) == 0 ) && ( i + 3 < argc ) ){
+      for( int j = 0; j < 3; j++ ) o->geometry[ j ] = atoi( argv[++i] );
+      if( !cache_geometry_ok( o->geometry[0], o->geometry[1], o->geometry[2] ) ) return 0;
+    }else if( ( strcmp( argv[i], "-H" ) == 0 ) && ( i + 4 < argc ) ){
+      int level, *l;
+      for( level = 0; level < NUM_LEVELS; level++ ){
+        if( strcmp( argv[ i + 1 ], level_names[ level ] ) == 0 ) break;
+      }
+      if( level == NUM_LEVELS ) return 0;
+      l = o->hierarchy[ level ];
+      for( int j = 0; j < 3; j++ ) l[ j ] = atoi( argv[ i + 2 + j ] );
+      if( !cache_geometry_ok( l[0], l[1], l[2] ) ) return 0;
+      i += 4;
+      if( level > 0 ){
+        if( ++i == argc ) return 0;
+        for( l[3] = 0; l[3] < NUM_INCLUSIONS; l[3]++ ){
+          if( strcmp( argv[i], inclusion_names[ l[3] ] ) == 0 ) break;
+        }
+        if( l[3] == NUM_INCLUSIONS ) return 0;
+      }
+    }else if( ( strcmp( argv[i], "-x" ) == 0 ) && ( i + 1 < argc ) ){
+      o->translate_file = argv[++i];
+    }else if( ( strcmp( argv[i], "-w" ) == 0 ) && ( i + 1 < argc ) ){
+      o->image_file = argv[++i];
+    }else if( ( strcmp( argv[i], "-T" ) == 0 ) && ( i + 1 < argc ) ){
+      o->trace_file = argv[++i];
+    }else if( ( strcmp( argv[i], "-s" ) == 0 ) && ( i + 2 < argc ) ){
+      o->snapshot_at = atoi( argv[++i] );
+      o->snapshot_file = argv[++i];
+      if( o->snapshot_at < 0 ) return 0;
+    }else if( ( strcmp( argv[i], "-P" ) == 0 ) && ( i + 1 < argc ) ){
+      i++;
+      if( strcmp( argv[i], "text" ) == 0 ){
+        o->profile = 1;
+      }else if( strcmp( argv[i], "csv" ) == 0 ){
+        o->profile = 2;
+      }else{
+        return 0;
+      }
+    }else if( ( strcmp( argv[i], "-O" ) == 0 ) && ( i + 2 < argc ) ){
+      i++;
+      if( strcmp( argv[i], "json" ) == 0 ){
+        o->export = 1;
+      }else if( strcmp( argv[i], "csv" ) == 0 ){
+        o->export = 2;
+      }else{
+        return 0;
+      }
+      o->export_file = argv[++i];
+    }else if( ( strcmp( argv[i], "-i" ) == 0 ) && ( i + 1 < argc ) ){
+      o->interval = atoi( argv[++i] );
+      if( o->interval < 1 ) return 0;
+    }else if( strcmp( argv[i], "-B" ) == 0 ){
+      o->predict = 1;
+    }else if( strcmp( argv[i], "-C" ) == 0 ){
+      o->timing = 1;
+    }else if( strcmp( argv[i], "-I" ) == 0 ){
+      o->ilp = 1;
+    }else if( strcmp( argv[i], "-M" ) == 0 ){
+      o->mrc = 1;
+    }else if( strcmp( argv[i], "-R" ) == 0 ){
+      o->policies = 1;
+    }else if( ( strcmp( argv[i], "-S" ) == 0 ) && ( i + 3 < argc ) ){
+      for( int j = 0; j < 3; j++ ) o->sample[ j ] = atoi( argv[++i] );
+      if( ( o->sample[0] < 0 ) || ( o->sample[1] < 0 ) || ( o->sample[2] < 1 ) ) return 0;
+    }else if( ( strcmp( argv[i], "-N" ) == 0 ) && ( i + 1 < argc ) ){
+      o->cores = atoi( argv[++i] );
+      if( o->cores < 1 ) return 0;
+    }else if( ( strcmp( argv[i], "-q" ) == 0 ) && ( i + 1 < argc ) ){
+      o->quantum = atoi( argv[++i] );
+      if( o->quantum < 1 ) return 0;
+    }else if( ( strcmp( argv[i], "-L" ) == 0 ) && ( i + 1 < argc ) ){
+      o->lane_file = argv[++i];
+    }else if( ( strcmp( argv[i], "-r" ) == 0 ) && ( i + 1 < argc ) ){
+      o->resume_file = argv[++i];
+    }else if( ( strcmp( argv[i], "-b" ) == 0 ) && ( i + 1 < argc ) ){
+      o->bench_runs = atoi( argv[++i] );
+      if( o->bench_runs < 1 ) return 0;
+    }else if( ( strcmp( argv[i], "-j" ) == 0 ) && ( i + 1 < argc ) ){
+      o->job_file = argv[++i];
+    }else if( ( strcmp( argv[i], "-p" ) == 0 ) && ( i + 1 < argc ) ){
+      o->threads = atoi( argv[++i] );
+      if( o->threads < 1 ) return 0;
+    }else{
+      return 0;
+    }
+  }
+  if( hierarchy_used( o ) && !hierarchy_ok( o ) ) return 0;
+  int instrumented = o->profile || o->predict || o->timing || o->ilp || o->mrc || o->policies ||
+                     hierarchy_used( o );
+  if( ( o->trace_file || o->snapshot_file || instrumented || o->sample[2] ) && o->verbose ) return 0;
+  if( o->trace_file && ( o->snapshot_file || o->resume_file || instrumented || o->sample[2] ) ) return 0;
+  if( o->sample[2] && instrumented ) return 0;
+  if( o->cores && ( o->verbose || o->engine || o->trace_file || o->snapshot_file || o->resume_file ||
+                    instrumented || o->sample[2] || o->bench_runs ) ) return 0;
+  if( o->lane_file && ( o->verbose || o->trace_file || o->snapshot_file || o->resume_file ||
+                        instrumented || o->sample[2] || o->bench_runs || o->cores ) ) return 0;
+  if( o->cache_off && ( o->sample[2] || o->cores ) ) return 0;
+  if( o->export && ( o->cores || o->lane_file ) ) return 0;
+  if( o->interval && ( !o->export || o->verbose || o->trace_file || o->sample[2] ) ) return 0;
+  if( ( o->geometry[0] || o->policy ) && o->resume_file ) return 0;
+  if( hierarchy_used( o ) && ( o->cache_off || o->resume_file ) ) return 0;
+  return 1;
+}
+
+/* run the loaded program to its halt and report */
+void run_simulation( struct machine *m, struct options *o ){
+  struct sampling sp = { .ff = o->sample[0], .warm = o->sample[1], .measure = o->sample[2] };
+  struct export x = { .csv = ( o->export == 2 ), .interval = o->interval };
+
+  if( o->cores ){
+    run_multicore( m, o->cores, o->quantum ? o->quantum : MC_QUANTUM );
+    return;
+  }
+
+  /* lanes that leave the vector machine finish on the chosen engine */
+  if( o->lane_file ){
+    run_lane_file( m, o->lane_file, engines[ o->engine ] );
+    return;
+  }
+
+  if( o->snapshot_file ){
+    FILE *f = fopen( o->snapshot_file, "wb" );
+    if( !f ){
+      fprintf( m->out, "cannot write %s\n", o->snapshot_file );
+      fail();
+    }
+    while( !m->halt_flag && ( m->inst_fetches < o->snapshot_at ) ) step( m );
+    struct snapshot *s = snapshot_take( m );
+    snapshot_write( m, s, f );
+    snapshot_free( s );
+    fclose( f );
+  }
+
+  /* only the basic engine produces trace output, so tracing always
+     uses it; a binary trace replaces the text */
+  if( o->export ) export_open( m, &x, o->export_file );
+  if( o->trace_file ){
+    struct tracer *t = trace_open( m, o->trace_file );
+    run_traced( m, t );
+    trace_close( t );
+  }else if( o->sample[2] ){
+    run_sampled( m, &sp );
+  }else if( o->profile || o->predict || o->timing || o->ilp || o->mrc || o->policies || hierarchy_used( o ) ){
+    if( hierarchy_used( o ) ) hierarchy_create( m, o->hierarchy );
+    if( o->profile ) profile_create( m );
+    if( o->predict ) predictors_create( m );
+    if( o->timing ) timing_create( m );
+    if( o->ilp ) ilp_create( m );
+    if( o->mrc ) mrc_create( m );
+    if( o->policies ) policies_create( m );
+    if( o->interval ){
+      run_intervals( m, &x, 1 );
+    }else{
+      run_instrumented( m );
+    }
+  }else if( o->interval ){
+    run_intervals( m, &x, 0 );
+  }else if( m->verbose ){
+    run_basic( m );
+  }else{
+    engines[ o->engine ]( m );
+  }
+
+  if( m->verbose ) fprintf( m->out, "\n" );
+  print_stats( m );
+  if( m->hier ) print_hierarchy( m );
+  if( o->export ) export_close( m, &x );
+  if( o->sample[2] ) print_sampling( m, &sp );
+  if( o->timing ) print_timing( m );
+  if( o->ilp ) print_ilp( m );
+  if( o->mrc ) print_mrc( m );
+  if( o->policies ) print_policies( m );
+  if( o->predict ) print_predictors( m );
+  if( o->profile ) print_profile( m, o->profile == 2 );
+}
+
+/* run the loaded program repeatedly under each engine and compare */
+void run_benchmark( struct machine *m, int runs ){
+  double secs[NUM_ENGINES];
+  long long count;
+  int stats[NUM_ENGINES][5];
+
+  fprintf( m->out, "engine benchmark (%d runs):\n", runs );
+  for( int e = 0; e < NUM_ENGINES; e++ ){
+    count = 0;
+    double start = now_seconds();
+    for( int r = 0; r < runs; r++ ){
+      reset_machine( m );
+      engines[ e ]( m );
+      count += m->inst_fetches;
+    }
+    secs[ e ] = now_seconds() - start;
+    stats[ e ][ 0 ] = m->inst_fetches;
+    stats[ e ][ 1 ] = m->memory_reads;
+    stats[ e ][ 2 ] = m->memory_writes;
+    stats[ e ][ 3 ] = m->branches;
+    stats[ e ][ 4 ] = m->taken;
+    fprintf( m->out, "  %-8s instructions = %lld  time = %.3f s  MIPS = %.1f  speedup = %.2fx\n",
+      engine_names[ e ], count, secs[ e ], count / secs[ e ] / 1e6, secs[ 0 ] / secs[ e ] );
+    if( memcmp( stats[ 0 ], stats[ e ], sizeof( stats[ 0 ] ) ) != 0 ){
+      fprintf( m->out, "  %-8s disagrees with basic on execution statistics\n", engine_names[ e ] );
+    }
+  }
+}
+
+/* batch runner: each line of the job file names a program followed by
+   its options.  Jobs are dealt round-robin onto one deque per worker; a
+   worker takes jobs from the back of its own deque and, when that runs
+   dry, steals from the front of the others'.  Every job writes into its
+   own buffer, and the buffers are printed in job-file order at the end.
+   A job that fails, on a bad image, a bad branch or running out of
+   memory, reports it in its own output and the other jobs go on */
+
+#define MAX_JOB_ARGS 32
+
+struct job {
+  char *text;                /* the job line as written           */
+  int argc;
+  char *argv[MAX_JOB_ARGS];  /* program file, then its options    */
+  char *output;              /* everything the job printed        */
+  size_t size;
+};
+
+struct deque {
+  pthread_mutex_t lock;
+  int *items,                /* job indexes, live in [head, tail) */
+      head,
+      tail;
+};
+
+struct pool {
+  struct job *jobs;
+  struct deque *queues;
+  int workers;
+};
+
+struct worker {
+  struct pool *pool;
+  int id;
+};
+
+int deque_pop( struct deque *q ){
+  int job = -1;
+  pthread_mutex_lock( &q->lock );
+  if( q->tail > q->head ) job = q->items[ --q->tail ];
+  pthread_mutex_unlock( &q->lock );
+  return job;
+}
+
+int deque_steal( struct deque *q ){
+  int job = -1;
+  pthread_mutex_lock( &q->lock );
+  if( q->tail > q->head ) job = q->items[ q->head++ ];
+  pthread_mutex_unlock( &q->lock );
+  return job;
+}
+
+void run_job( struct job *job ){
+  struct options o = { 0 };
+  FILE *out = open_memstream( &job->output, &job->size );
+  FILE *in = fopen( job->argv[0], "r" );
+
+  if( !in ){
+    fprintf( out, "cannot read %s\n", job->argv[0] );
+  }else if( !parse_options( &o, job->argc, job->argv, 1 ) ||
+            o.bench_runs || o.translate_file || o.image_file || o.job_file || o.resume_file ){
+    fprintf( out, "bad options in job\n" );
+  }else{
+    /* an error that would end the simulator longjmps back here, having
+       printed why, and the rest of the batch still runs */
+    jmp_buf escape;
+    struct machine *volatile m = NULL;
+
+    fail_escape = &escape;
+    fail_out = out;
+    if( !setjmp( escape ) ){
+      m = machine_create( out );
+      m->job = 1;
+      m->verbose = o.verbose;
+      if( o.geometry[0] ) cache_configure( &m->cache, o.geometry[0], o.geometry[1], o.geometry[2] );
+      m->cache.policy = o.policy;
+      m->cache.off = o.cache_off;
+      if( get_mem( m, in ) == 0 ) run_simulation( m, &o );
+    }
+    fail_escape = NULL;
+    if( m ) machine_free( m );
+  }
+  if( in ) fclose( in );
+  fclose( out );
+}
+
+void *worker_main( void *arg ){
+  struct worker *w = arg;
+  struct pool *p = w->pool;
+  int job;
+
+  for( ;; ){
+    job = deque_pop( &p->queues[ w->id ] );
+    for( int i = 1; ( job < 0 ) && ( i < p->workers ); i++ ){
+      job = deque_steal( &p->queues[ ( w->id + i ) % p->workers ] );
+    }
+    if( job < 0 ) return NULL;   /* jobs are never added, so all are taken */
+    run_job( &p->jobs[ job ] );
+  }
+}
+
+int run_batch( struct options *o ){
+  FILE *f = fopen( o->job_file, "r" );
+  if( !f ){
+    printf( "cannot read %s\n", o->job_file );
+    return -1;
+  }
+
+  struct pool p = { NULL, NULL, o->threads ? o->threads : (int)sysconf( _SC_NPROCESSORS_ONLN ) };
+  int num_jobs = 0, max_jobs = 0;
+  char line[1024];
+
+  while( fgets( line, sizeof( line ), f ) ){
+    line[ strcspn( line, "\r\n" ) ] = '\0';
+    char *first = line + strspn( line, " \t" );
+    if( ( *first == '\0' ) || ( *first == '#' ) ) continue;
+    if( num_jobs == max_jobs ){
+      max_jobs = max_jobs ? 2 * max_jobs : 64;
+      p.jobs = realloc( p.jobs, max_jobs * sizeof( struct job ) );
+    }
+    struct job *job = &p.jobs[ num_jobs++ ];
+    memset( job, 0, sizeof( *job ) );
+    job->text = strdup( first );
+    char *copy = strdup( first );
+    for( char *t = strtok( copy, " \t" ); t && ( job->argc < MAX_JOB_ARGS ); t = strtok( NULL, " \t" ) ){
+      job->argv[ job->argc++ ] = t;
+    }
+  }
+  fclose( f );
+
+  if( p.workers > num_jobs ) p.workers = num_jobs ? num_jobs : 1;
+  p.queues = calloc( p.workers, sizeof( struct deque ) );
+  for( int i = 0; i < p.workers; i++ ){
+    pthread_mutex_init( &p.queues[ i ].lock, NULL );
+    p.queues[ i ].items = malloc( ( num_jobs / p.workers + 1 ) * sizeof( int ) );
+  }
+  for( int i = 0; i < num_jobs; i++ ){
+    struct deque *q = &p.queues[ i % p.workers ];
+    q->items[ q->tail++ ] = i;
+  }
+
+  pthread_t threads[p.workers];
+  struct worker workers[p.workers];
+  for( int i = 0; i < p.workers; i++ ){
+    workers[ i ].pool = &p;
+    workers[ i ].id = i;
+    pthread_create( &threads[ i ], NULL, worker_main, &workers[ i ] );
+  }
+  for( int i = 0; i < p.workers; i++ ) pthread_join( threads[ i ], NULL );
+
+  for( int i = 0; i < num_jobs; i++ ){
+    printf( "job %d: %s\n", i + 1, p.jobs[ i ].text );
+    fwrite( p.jobs[ i ].output, 1, p.jobs[ i ].size, stdout );
+    printf( "\n" );
+  }
+  return 0;
+}
+
+void usage( char *name ){
+  printf( "usage:\n");
+  printf( "  %s for just execution statistics\n", name );
+  printf( "  %s -t for instruction trace\n", name );
+  printf( "  %s -v for instructions, registers, and memory\n", name );
+  printf( "options:\n" );
+  printf( "  -e basic|threaded|jit  select the execution engine\n" );
+  printf( "  -c policy|off          data cache replacement, one of plru lru fifo random nru\n" );
+  printf( "                         srrip brrip drrip (default plru), or no cache\n" );
+  printf( "  -G sets ways line      data cache geometry, powers of two (default 8 4 16)\n" );
+  printf( "  -H l1i sets ways line  instruction cache; any -H splits L1 and counts fetches\n" );
+  printf( "  -H l2|l3 sets ways line inclusive|exclusive|nine\n" );
+  printf( "                         unified lower cache levels, L3 below L2\n" );
+  printf( "  -b n                   time n runs under each engine\n" );
+  printf( "  -x file.c              translate the program to C and exit\n" );
+  printf( "  -w file.img            write the program as a binary image and exit\n" );
+  printf( "  -T file.trc            write a binary execution trace; see simtrace\n" );
+  printf( "  -s n file              save a snapshot after n instructions\n" );
+  printf( "  -r file                resume from a snapshot instead of reading stdin\n" );
+  printf( "  -P text|csv            report counts per address and loop trip counts\n" );
+  printf( "  -O json|csv file       also write the statistics to file\n" );
+  printf( "  -i n                   with -O, sample the statistics every n instructions\n" );
+  printf( "  -B                     compare branch predictors\n" );
+  printf( "  -C                     count pipeline cycles and stalls\n" );
+  printf( "  -I                     ideal IPC by window size and renaming, and instruction mix\n" );
+  printf( "  -M                     LRU miss ratio of every data cache size, by set count\n" );
+  printf( "  -R                     compare replacement policies with Belady's OPT\n" );
+  printf( "  -S n w m               sample: n fast-forward, w warm-up, m measured, repeated\n" );
+  printf( "  -N n                   run n cores with coherent caches; r31 = core, r30 = n\n" );
+  printf( "  -q n                   instructions each core runs between barriers for -N\n" );
+  printf( "  -L file                run once per line of file, rN=v [addr]=v, 16 at a time\n" );
+  printf( "  -j file                run the jobs in file, one \"program options\" per line\n" );
+  printf( "  -p n                   number of worker threads for -j\n" );
+  printf( "input is read from stdin as hex 32-bit values or a binary image\n" );
+  exit( -1 );
+}
+
+#ifndef SIM_NO_MAIN
+
+int main( int argc, char **argv ){
+  struct options o = { 0 };
+
+  if( !parse_options( &o, argc, argv, 1 ) ) usage( argv[0] );
+
+  if( o.job_file ) return run_batch( &o );
+
+  struct machine *m = machine_create( stdout );
+  m->verbose = o.verbose;
+  if( o.geometry[0] ) cache_configure( &m->cache, o.geometry[0], o.geometry[1], o.geometry[2] );
+  m->cache.policy = o.policy;
+  if( o.resume_file ){
+    FILE *f = fopen( o.resume_file, "rb" );
+    if( !f ){
+      printf( "cannot read %s\n", o.resume_file );
+      exit( -1 );
+    }
+    struct snapshot *s = snapshot_read( m, f );
+    snapshot_restore( m, s );
+    snapshot_free( s );
+    fclose( f );
+  }else if( get_mem( m, stdin ) ){
+    exit( -1 );
+  }
+  m->cache.off = o.cache_off;   /* after a snapshot's cache */
+
+  if( o.translate_file ){
+    FILE *out = fopen( o.translate_file, "w" );
+    if( !out ){
+      printf( "cannot write %s\n", o.translate_file );
+      exit( -1 );
+    }
+    translate_program( m, out );
+    fclose( out );
+    return 0;
+  }
+
+  if( o.image_file ){
+    FILE *out = fopen( o.image_file, "wb" );
+    if( !out ){
+      printf( "cannot write %s\n", o.image_file );
+      exit( -1 );
+    }
+    write_image( m, out );
+    fclose( out );
+    return 0;
+  }
+
+  if( o.bench_runs ){
+    if( m->verbose ) usage( argv[0] );
+    run_benchmark( m, o.bench_runs );
+    return 0;
+  }
+
+  run_simulation( m, &o );
+  return 0;
+}
+
+#endif
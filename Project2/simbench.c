@@ -0,0 +1,299 @@
+// Abigail Poropatich
+// CPSC 3300: Computer Organization
+// Project 2: i860 Simulator and cache system
+//
+// simbench: run the workloads in bench/ under each engine and report
+// simulated instructions per second, wall time and peak memory, checked
+// against a stored baseline.  Build with
+//   gcc -O2 -pthread -o simbench simbench.c -lm
+// and run it from this directory.  The baseline's statistics hold on any
+// host, but its MIPS were measured on one machine; rewrite it with -u
+// before comparing throughput somewhere else.  With -a it instead times
+// the data cache alone at each associativity.
+
+#define SIM_NO_MAIN
+#include "sim.c"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define NUM_WORKLOADS 6
+#define MAX_BASELINE  64
+#define CACHE_BENCH_BYTES    ( 32 * 1024 )   /* capacity at every associativity */
+#define CACHE_BENCH_LINE     32
+#define CACHE_BENCH_ACCESSES ( 1 << 22 )
+
+const char *workloads[NUM_WORKLOADS] = { "memcpy", "stride", "matmul", "list", "sort", "thrash" };
+
+/* one workload under one engine.  The counters are the execution and
+   cache statistics, which must match the baseline exactly; mips must
+   not fall more than the tolerance below it */
+
+struct result {
+  char workload[32],
+       engine[16];
+  int counters[NUM_COUNTERS];
+  double mips;
+};
+
+/* what the child running a workload reports back */
+
+struct measurement {
+  int ok,
+      counters[NUM_COUNTERS];
+  double seconds;            /* fastest run                       */
+  long long instructions;    /* of that run                       */
+};
+
+/* runs in the child: load the program and time runs of it */
+void measure( const char *file, int engine, int runs, struct measurement *r ){
+  FILE *in = fopen( file, "r" );
+  if( !in ) return;
+
+  struct machine *m = machine_create( stdout );
+  int loaded = ( get_mem( m, in ) == 0 );
+  fclose( in );
+  if( !loaded ){
+    machine_free( m );
+    return;
+  }
+  for( int i = 0; i < runs; i++ ){
+    reset_machine( m );
+    double start = now_seconds();
+    engines[ engine ]( m );
+    double secs = now_seconds() - start;
+    if( ( i == 0 ) || ( secs < r->seconds ) ) r->seconds = secs;
+  }
+  collect_counters( m, r->counters );
+  r->instructions = m->inst_fetches;
+  r->ok = 1;
+  machine_free( m );
+}
+
+/* each workload runs in its own process so that its peak resident set
+   is not hidden by an earlier, larger one */
+int run_workload( const char *file, int engine, int runs, struct measurement *r,
+                  double *wall, long *rss_kb ){
+  int fd[2];
+  struct rusage usage;
+  int status;
+
+  memset( r, 0, sizeof( *r ) );
+  if( pipe( fd ) != 0 ) return 0;
+  double start = now_seconds();
+  pid_t pid = fork();
+  if( pid < 0 ) return 0;
+  if( pid == 0 ){
+    close( fd[0] );
+    measure( file, engine, runs, r );
+    if( write( fd[1], r, sizeof( *r ) ) != sizeof( *r ) ) _exit( 1 );
+    _exit( 0 );
+  }
+  close( fd[1] );
+  ssize_t got = read( fd[0], r, sizeof( *r ) );
+  close( fd[0] );
+  wait4( pid, &status, 0, &usage );
+  *wall = now_seconds() - start;
+  *rss_kb = usage.ru_maxrss;
+  return ( got == sizeof( *r ) ) && WIFEXITED( status ) && ( WEXITSTATUS( status ) == 0 ) && r->ok;
+}
+
+/* a baseline file has one line per workload and engine:
+     workload engine counters... mips
+   with lines starting with # ignored */
+int read_baseline( const char *name, struct result *base ){
+  FILE *f = fopen( name, "r" );
+  char line[512];
+  int n = 0;
+
+  if( !f ) return 0;
+  while( fgets( line, sizeof( line ), f ) && ( n < MAX_BASELINE ) ){
+    struct result *b = &base[ n ];
+    int *c = b->counters;
+    if( line[0] == '#' ) continue;
+    if( sscanf( line, "%31s %15s %d %d %d %d %d %d %d %d %d %d %lf", b->workload, b->engine,
+                &c[0], &c[1], &c[2], &c[3], &c[4], &c[5], &c[6], &c[7], &c[8], &c[9], &b->mips ) == 13 ) n++;
+  }
+  fclose( f );
+  return n;
+}
+
+void write_baseline( const char *name, struct result *base, int n ){
+  FILE *f = fopen( name, "w" );
+  if( !f ){
+    printf( "cannot write %s\n", name );
+    exit( -1 );
+  }
+  fprintf( f, "# workload engine instructions reads writes branches taken "
+              "cache_reads cache_writes hits misses write_backs mips\n" );
+  for( int i = 0; i < n; i++ ){
+    fprintf( f, "%s %s", base[ i ].workload, base[ i ].engine );
+    for( int j = 0; j < NUM_COUNTERS; j++ ) fprintf( f, " %d", base[ i ].counters[ j ] );
+    fprintf( f, " %.1f\n", base[ i ].mips );
+  }
+  fclose( f );
+}
+
+struct result *find_result( struct result *base, int n, const char *workload, const char *engine ){
+  for( int i = 0; i < n; i++ ){
+    if( ( strcmp( base[ i ].workload, workload ) == 0 ) && ( strcmp( base[ i ].engine, engine ) == 0 ) ) return &base[ i ];
+  }
+  return NULL;
+}
+
+/* accesses per second of cache_access() at each associativity from 1
+   to 32 ways, the capacity and line size fixed.  The random streams,
+   one write in four, cover half the cache, where nearly every access
+   hits, and twice the cache, where about half miss */
+void cache_bench( int runs ){
+  unsigned int *stream = malloc( CACHE_BENCH_ACCESSES * sizeof( unsigned int ) ), x = 1;
+  struct cache c = { 0 };
+
+  if( !stream ){
+    printf( "out of memory\n" );
+    exit( -1 );
+  }
+  printf( "%-6s %6s %12s %9s %12s %9s\n", "ways", "sets", "M acc/s", "hit rate", "M acc/s", "hit rate" );
+  printf( "%-6s %6s %22s %22s\n", "", "", "half the cache", "twice the cache" );
+  for( unsigned int ways = 1; ways <= 32; ways *= 2 ){
+    unsigned int sets = CACHE_BENCH_BYTES / CACHE_BENCH_LINE / ways;
+    cache_configure( &c, sets, ways, CACHE_BENCH_LINE );
+    printf( "%-6u %6u", ways, sets );
+    for( unsigned int footprint = CACHE_BENCH_BYTES / 2; footprint <= 2 * CACHE_BENCH_BYTES; footprint *= 4 ){
+      double best = 0;
+      for( int i = 0; i < CACHE_BENCH_ACCESSES; i++ ){
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        stream[ i ] = ( ( x % footprint ) & ~3u ) | ( ( x >> 30 ) == 0 );   /* bit 0: a write */
+      }
+      for( int r = 0; r < runs; r++ ){
+        cache_init( &c );
+        double start = now_seconds();
+        for( int i = 0; i < CACHE_BENCH_ACCESSES; i++ ) cache_access( &c, stream[ i ] & ~1u, stream[ i ] & 1 );
+        double secs = now_seconds() - start;
+        if( ( r == 0 ) || ( secs < best ) ) best = secs;
+      }
+      printf( " %12.1f %8.1f%%", CACHE_BENCH_ACCESSES / best / 1e6, 100.0 * c.hits / CACHE_BENCH_ACCESSES );
+    }
+    printf( "\n" );
+  }
+  cache_free( &c );
+  free( stream );
+}
+
+void bench_usage( char *name ){
+  printf( "usage:\n" );
+  printf( "  %s to run every workload under every engine and compare with the baseline\n", name );
+  printf( "options:\n" );
+  printf( "  -e basic|threaded|jit  run only this engine\n" );
+  printf( "  -n runs                time the fastest of this many runs (default 3)\n" );
+  printf( "  -d dir                 directory holding the workloads (default bench)\n" );
+  printf( "  -f file                baseline file (default dir/baseline)\n" );
+  printf( "  -l percent             slowdown allowed before a regression (default 15)\n" );
+  printf( "  -u                     update the baseline with this run's results\n" );
+  printf( "  -a                     time the data cache alone at each associativity\n" );
+  exit( -1 );
+}
+
+int main( int argc, char **argv ){
+  const char *dir = "bench";
+  char *baseline_file = NULL, file[1024], default_baseline[1024];
+  int engine = -1, runs = 3, update = 0, failures = 0, cache_only = 0;
+  double limit = 15;
+
+  for( int i = 1; i < argc; i++ ){
+    if( ( strcmp( argv[i], "-e" ) == 0 ) && ( i + 1 < argc ) ){
+      i++;
+      for( engine = 0; engine < NUM_ENGINES; engine++ ){
+        if( strcmp( argv[i], engine_names[ engine ] ) == 0 ) break;
+      }
+      if( engine == NUM_ENGINES ) bench_usage( argv[0] );
+    }else if( ( strcmp( argv[i], "-n" ) == 0 ) && ( i + 1 < argc ) ){
+      runs = atoi( argv[++i] );
+      if( runs < 1 ) bench_usage( argv[0] );
+    }else if( ( strcmp( argv[i], "-d" ) == 0 ) && ( i + 1 < argc ) ){
+      dir = argv[++i];
+    }else if( ( strcmp( argv[i], "-f" ) == 0 ) && ( i + 1 < argc ) ){
+      baseline_file = argv[++i];
+    }else if( ( strcmp( argv[i], "-l" ) == 0 ) && ( i + 1 < argc ) ){
+      limit = atof( argv[++i] );
+      if( limit < 0 ) bench_usage( argv[0] );
+    }else if( strcmp( argv[i], "-u" ) == 0 ){
+      update = 1;
+    }else if( strcmp( argv[i], "-a" ) == 0 ){
+      cache_only = 1;
+    }else{
+      bench_usage( argv[0] );
+    }
+  }
+  if( cache_only ){
+    cache_bench( runs );
+    return 0;
+  }
+  if( !baseline_file ){
+    snprintf( default_baseline, sizeof( default_baseline ), "%s/baseline", dir );
+    baseline_file = default_baseline;
+  }
+
+  struct result base[MAX_BASELINE];
+  int num_base = read_baseline( baseline_file, base );
+
+  printf( "%-8s %-8s %12s %8s %8s %10s %9s %8s  %s\n",
+    "workload", "engine", "instructions", "wall s", "MIPS", "peak RSS", "baseline", "change", "status" );
+  for( int w = 0; w < NUM_WORKLOADS; w++ ){
+    for( int e = 0; e < NUM_ENGINES; e++ ){
+      if( ( engine >= 0 ) && ( e != engine ) ) continue;
+
+      struct measurement r;
+      double wall;
+      long rss_kb;
+      snprintf( file, sizeof( file ), "%s/%s.in", dir, workloads[ w ] );
+      if( !run_workload( file, e, runs, &r, &wall, &rss_kb ) ){
+        printf( "%-8s %-8s cannot run %s\n", workloads[ w ], engine_names[ e ], file );
+        failures++;
+        continue;
+      }
+
+      struct result now = { "", "", { 0 }, r.instructions / r.seconds / 1e6 };
+      snprintf( now.workload, sizeof( now.workload ), "%s", workloads[ w ] );
+      snprintf( now.engine, sizeof( now.engine ), "%s", engine_names[ e ] );
+      memcpy( now.counters, r.counters, sizeof( now.counters ) );
+
+      struct result *b = find_result( base, num_base, now.workload, now.engine );
+      const char *status = "new";
+      if( b ){
+        if( memcmp( b->counters, now.counters, sizeof( now.counters ) ) != 0 ){
+          status = "STATISTICS CHANGED";
+          failures++;
+        }else if( now.mips < b->mips * ( 1 - limit / 100 ) ){
+          status = "SLOWER";
+          failures++;
+        }else{
+          status = "ok";
+        }
+      }
+
+      printf( "%-8s %-8s %12lld %8.3f %8.1f %7ld KB", now.workload, now.engine,
+        r.instructions, wall, now.mips, rss_kb );
+      if( b ){
+        printf( " %9.1f %+7.1f%%  %s\n", b->mips, 100 * ( now.mips / b->mips - 1 ), status );
+      }else{
+        printf( " %9s %8s  %s\n", "-", "-", status );
+      }
+
+      if( update ){
+        if( !b && ( num_base < MAX_BASELINE ) ) b = &base[ num_base++ ];
+        if( b ) *b = now;
+      }
+    }
+  }
+
+  if( update ){
+    write_baseline( baseline_file, base, num_base );
+    printf( "baseline written to %s\n", baseline_file );
+    return 0;
+  }
+  if( failures ) printf( "%d failure%s\n", failures, ( failures == 1 ) ? "" : "s" );
+  return failures ? 1 : 0;
+}
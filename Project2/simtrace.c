@@ -0,0 +1,86 @@
+// Abigail Poropatich
+// CPSC 3300: Computer Organization
+// Project 2: i860 Simulator and cache system
+//
+// simtrace: render a binary trace written by sim -T as the text sim -t
+// or sim -v would have printed.  Build with
+//   gcc -O2 -pthread -o simtrace simtrace.c -lm
+// and check it against sim on the course programs, where every mode
+// must match exactly:
+//   for f in cs1.in ../tc1.in ../tc2.in; do for v in "" -t -v; do
+//     ./sim -T /tmp/check.trc < $f > /dev/null
+//     ./simtrace $v < /tmp/check.trc | cmp - <( ./sim $v < $f ) || echo "$f $v"
+//   done; done
+
+#define SIM_NO_MAIN
+#include "sim.c"
+
+/* Each record is shown by running its instruction's handler with the
+   registers as the trace left them, which prints the instruction text
+   and keeps the statistics, and then setting the registers and cc from
+   the record.  Loaded values come from the trace, not from memory */
+
+void render_trace( struct machine *m, const unsigned char *p, const unsigned char *end ){
+  uint32_t pc, ir;
+
+  if( m->verbose ) fprintf( m->out, "instruction trace:\n" );
+  while( p + 10 <= end ){
+    int flags = p[8], changed = p[9];
+    memcpy( &pc, p, 4 );
+    memcpy( &ir, p + 4, 4 );
+    p += 10;
+    if( flags & TRACE_READ ) p += 4;        /* address  */
+    if( flags & TRACE_WRITE ) p += 8;       /* address and value */
+
+    if( m->verbose ) fprintf( m->out, "at %02x, ", pc );
+    m->xip = pc;
+    m->fip = pc + 4;
+    m->inst_fetches++;
+    m->ir = ir;
+    decode( m );
+    ( op_table[ m->op1 ] ? op_table[ m->op1 ] : ignore_op )( m );
+
+    for( int i = 0; i < changed; i++, p += 5 ) memcpy( &m->reg[ p[0] ], p + 1, 4 );
+    m->reg[ 0 ] = 0;
+    m->cc_bit = flags & TRACE_CC;
+
+    if( ( m->verbose > 1 ) || ( m->halt_flag && ( m->verbose == 1 )) ) print_regs( m );
+  }
+}
+
+int main( int argc, char **argv ){
+  struct machine *m = machine_create( stdout );
+  struct trace_header h = { 0 };
+  size_t size;
+  int mapped;
+
+  if( ( argc == 2 ) && ( strcmp( argv[1], "-t" ) == 0 ) ){
+    m->verbose = 1;
+  }else if( ( argc == 2 ) && ( strcmp( argv[1], "-v" ) == 0 ) ){
+    m->verbose = 2;
+  }else if( argc != 1 ){
+    printf( "usage:\n" );
+    printf( "  %s < file.trc for just execution statistics\n", argv[0] );
+    printf( "  %s -t < file.trc for instruction trace\n", argv[0] );
+    printf( "  %s -v < file.trc for instructions, registers, and memory\n", argv[0] );
+    exit( -1 );
+  }
+
+  char *buf = read_input( stdin, &size, &mapped );
+  if( size >= sizeof( h ) ) memcpy( &h, buf, sizeof( h ) );
+  if( ( h.magic != TRACE_MAGIC ) || ( h.version != TRACE_VERSION ) ||
+      ( sizeof( h ) + (size_t)h.image_size > size ) ){
+    printf( "bad trace header\n" );
+    exit( -1 );
+  }
+
+  if( parse_binary( m, buf + sizeof( h ), h.image_size ) ) exit( -1 );
+  m->image.from_hex = h.from_hex;
+  if( m->verbose > 1 ) list_image( m );
+  install_image( m );
+
+  render_trace( m, (unsigned char *)buf + sizeof( h ) + h.image_size, (unsigned char *)buf + size );
+  if( m->verbose ) fprintf( m->out, "\n" );
+  print_stats( m );
+  return 0;
+}